@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * Benchmark helpers.
+ *
+ * Benchmarks print nanoseconds per operation, lower is better.
+ * Absolute numbers depend on the machine, compare rows of the same run.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline double bench_now()
+/*
+ * Return monotonic time in seconds.
+ */
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void bench_report(const char* name, double seconds, size_t num_ops)
+{
+    printf("  %-48s %10.2f ns/op\n", name, seconds * 1e9 / num_ops);
+}
+
+/*
+ * Benchmarks, see main.c
+ */
+
+void bench_pmr();
+void bench_arena_fit();
+void bench_sync_arena();
+void bench_huge_pages();
+void bench_fsb_magazines();
+void bench_fsb_first_free();
+void bench_fsb_coloring();
+void bench_fsb_pool();
+void bench_allocators();
+
+#ifdef __cplusplus
+}
+#endif
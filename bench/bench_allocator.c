@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include "allocator.h"
+#include "bench.h"
+
+/****************************************************************
+ * Allocators with random sizes: fsb_allocator, pet_allocator and malloc.
+ *
+ * Each thread keeps a working set of blocks and replaces random ones.
+ * Sizes are mostly small with occasional blocks above 4K, which
+ * fsb_allocator and pet_allocator map directly. The second pass uses small blocks only.
+ * One operation is release of a block and allocation of new one.
+ */
+
+#define ALLOCATOR_TOTAL_OPS    (4 * 1024 * 1024)
+#define ALLOCATOR_WORKING_SET  1024
+#define ALLOCATOR_MAX_THREADS  8
+
+typedef struct {
+    Allocator* allocator;
+    unsigned num_ops;
+    unsigned seed;
+    bool large_blocks;
+} AllocatorTask;
+
+static inline unsigned next_random(unsigned* state)
+{
+    // xorshift32
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static inline unsigned random_size(unsigned* state, bool large_blocks)
+{
+    unsigned r = next_random(state);
+    if (large_blocks && (r & 63) == 0) {
+        return 4096 + (r >> 6) % 65536;
+    }
+    return 1 + (r >> 6) % 512;
+}
+
+static int allocator_worker(void* arg)
+{
+    AllocatorTask* task = arg;
+    Allocator* allocator = task->allocator;
+    unsigned state = task->seed;
+    void* blocks[ALLOCATOR_WORKING_SET];
+    unsigned sizes[ALLOCATOR_WORKING_SET];
+
+    for (unsigned i = 0; i < ALLOCATOR_WORKING_SET; i++) {
+        sizes[i] = random_size(&state, task->large_blocks);
+        blocks[i] = allocator->allocate(sizes[i], false);
+    }
+    for (unsigned n = 0; n < task->num_ops; n++) {
+        unsigned i = next_random(&state) % ALLOCATOR_WORKING_SET;
+        allocator->release(&blocks[i], sizes[i]);
+        sizes[i] = random_size(&state, task->large_blocks);
+        blocks[i] = allocator->allocate(sizes[i], false);
+        if (!blocks[i]) {
+            abort();
+        }
+        *(uint8_t*) blocks[i] = n;
+    }
+    for (unsigned i = 0; i < ALLOCATOR_WORKING_SET; i++) {
+        allocator->release(&blocks[i], sizes[i]);
+    }
+    return 0;
+}
+
+static void run_allocator(const char* name, Allocator* allocator, unsigned num_threads, bool large_blocks)
+{
+    thrd_t threads[ALLOCATOR_MAX_THREADS];
+    AllocatorTask tasks[ALLOCATOR_MAX_THREADS];
+    double start = bench_now();
+    for (unsigned i = 0; i < num_threads; i++) {
+        tasks[i] = (AllocatorTask) {
+            .allocator = allocator,
+            .num_ops = ALLOCATOR_TOTAL_OPS / num_threads,
+            .seed = 2463534242u + i,
+            .large_blocks = large_blocks
+        };
+        if (thrd_create(&threads[i], allocator_worker, &tasks[i]) != thrd_success) {
+            abort();
+        }
+    }
+    for (unsigned i = 0; i < num_threads; i++) {
+        thrd_join(threads[i], nullptr);
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%s, %u threads%s", name, num_threads, large_blocks? "" : ", small only");
+    bench_report(label, bench_now() - start, ALLOCATOR_TOTAL_OPS);
+}
+
+void bench_allocators()
+{
+    // pet allocator is initialized in main
+    fsb_allocator.init();
+
+    for (unsigned pass = 0; pass < 2; pass++) {
+        bool large_blocks = pass == 0;
+        for (unsigned num_threads = 1; num_threads <= ALLOCATOR_MAX_THREADS; num_threads *= 2) {
+            run_allocator("fsb_allocator", &fsb_allocator, num_threads, large_blocks);
+            run_allocator("pet_allocator", &pet_allocator, num_threads, large_blocks);
+            run_allocator("malloc", &stdlib_allocator, num_threads, large_blocks);
+        }
+    }
+}
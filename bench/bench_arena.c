@@ -0,0 +1,228 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include "allocator.h"
+#include "arena.h"
+#include "bench.h"
+#include "pages.h"
+
+/****************************************************************
+ * _arena_fit with free space index against linear scan of regions.
+ *
+ * All regions but the last one are full. Linear scan is emulated
+ * with a list of single-region contiguous arenas that try each one
+ * in turn, this is what _arena_fit did before the index.
+ */
+
+#define FIT_BLOCK_SIZE     16
+#define FIT_LAST_CAPACITY  (16 * 1024 * 1024)
+
+static unsigned fill_region(Arena* arena, uint8_t** last_block)
+/*
+ * Allocate 8-byte blocks until the arena moves to the next region.
+ * Return the number of blocks allocated.
+ */
+{
+    unsigned n = 0;
+    for (;;) {
+        uint8_t* block = _arena_alloc(arena, 8, 8);
+        if (!block) {
+            return n;
+        }
+        n++;
+        if (*last_block && block != *last_block + 8) {
+            *last_block = block;
+            return n;
+        }
+        *last_block = block;
+    }
+}
+
+static void fit_indexed(unsigned num_regions, unsigned num_ops)
+{
+    Arena* arena = create_arena(sys_page_size);
+    uint8_t* last_block = nullptr;
+    for (unsigned i = 0; i < num_regions; i++) {
+        fill_region(arena, &last_block);
+    }
+    set_region_capacity(arena, FIT_LAST_CAPACITY);
+    _arena_alloc(arena, FIT_BLOCK_SIZE, 1);
+
+    double start = bench_now();
+    for (unsigned i = 0; i < num_ops; i++) {
+        if (!_arena_fit(arena, FIT_BLOCK_SIZE, 1)) {
+            abort();
+        }
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "arena_fit indexed, %u regions", num_regions);
+    bench_report(name, bench_now() - start, num_ops);
+    delete_arena(arena);
+}
+
+static void fit_linear(unsigned num_regions, unsigned num_ops)
+{
+    Arena** arenas = malloc(sizeof(Arena*) * (num_regions + 1));
+    for (unsigned i = 0; i < num_regions; i++) {
+        arenas[i] = create_contiguous_arena(1, 0);
+        while (_arena_alloc(arenas[i], 8, 8)) {}
+    }
+    arenas[num_regions] = create_contiguous_arena(FIT_LAST_CAPACITY, 0);
+
+    double start = bench_now();
+    for (unsigned i = 0; i < num_ops; i++) {
+        void* block = nullptr;
+        for (unsigned r = 0; r <= num_regions && !block; r++) {
+            block = _arena_alloc(arenas[r], FIT_BLOCK_SIZE, 1);
+        }
+        if (!block) {
+            abort();
+        }
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "linear scan, %u regions", num_regions);
+    bench_report(name, bench_now() - start, num_ops);
+    for (unsigned i = 0; i <= num_regions; i++) {
+        delete_arena(arenas[i]);
+    }
+    free(arenas);
+}
+
+void bench_arena_fit()
+{
+    unsigned region_counts[] = { 10, 1000, 100000 };
+    for (unsigned i = 0; i < 3; i++) {
+        unsigned n = region_counts[i];
+        fit_indexed(n, 100000);
+        fit_linear(n, (n < 100)? 100000 : 10000000 / n);
+    }
+}
+
+/****************************************************************
+ * SyncArena against Arena wrapped in mutex, 1 to 64 threads.
+ *
+ * The total number of allocations is the same for any number of threads.
+ */
+
+#define SYNC_TOTAL_OPS    (4 * 1024 * 1024)
+#define SYNC_BLOCK_SIZE   32
+#define SYNC_CHUNK_SIZE   65536
+#define SYNC_MAX_THREADS  64
+
+typedef struct {
+    SyncArena* sarena;
+    Arena* arena;
+    mtx_t* lock;
+    unsigned num_ops;
+} SyncArenaTask;
+
+static int sync_arena_worker(void* arg)
+{
+    SyncArenaTask* task = arg;
+    for (unsigned i = 0; i < task->num_ops; i++) {
+        uint8_t* block = _sync_arena_alloc(task->sarena, SYNC_BLOCK_SIZE, 8);
+        if (!block) {
+            abort();
+        }
+        *block = i;
+    }
+    return 0;
+}
+
+static int locked_arena_worker(void* arg)
+{
+    SyncArenaTask* task = arg;
+    for (unsigned i = 0; i < task->num_ops; i++) {
+        mtx_lock(task->lock);
+        uint8_t* block = _arena_alloc(task->arena, SYNC_BLOCK_SIZE, 8);
+        mtx_unlock(task->lock);
+        if (!block) {
+            abort();
+        }
+        *block = i;
+    }
+    return 0;
+}
+
+static void run_threads(const char* name, unsigned num_threads, thrd_start_t worker, SyncArenaTask* task)
+{
+    thrd_t threads[SYNC_MAX_THREADS];
+    double start = bench_now();
+    for (unsigned i = 0; i < num_threads; i++) {
+        if (thrd_create(&threads[i], worker, task) != thrd_success) {
+            abort();
+        }
+    }
+    for (unsigned i = 0; i < num_threads; i++) {
+        thrd_join(threads[i], nullptr);
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%s, %u threads", name, num_threads);
+    bench_report(label, bench_now() - start, task->num_ops * num_threads);
+}
+
+void bench_sync_arena()
+{
+    for (unsigned num_threads = 1; num_threads <= SYNC_MAX_THREADS; num_threads *= 2) {
+        SyncArenaTask task = { .num_ops = SYNC_TOTAL_OPS / num_threads };
+
+        task.sarena = create_sync_arena(SYNC_CHUNK_SIZE);
+        run_threads("SyncArena", num_threads, sync_arena_worker, &task);
+        delete_sync_arena(task.sarena);
+
+        mtx_t lock;
+        mtx_init(&lock, mtx_plain);
+        task.arena = create_arena(SYNC_CHUNK_SIZE);
+        task.lock = &lock;
+        run_threads("Arena with mutex", num_threads, locked_arena_worker, &task);
+        delete_arena(task.arena);
+        mtx_destroy(&lock);
+    }
+}
+
+/****************************************************************
+ * Random reads from arena with and without huge pages.
+ */
+
+#define HUGE_ARENA_SIZE  (256 * 1024 * 1024)
+#define HUGE_NUM_READS   (16 * 1024 * 1024)
+
+static void random_reads(const char* name, unsigned page_flags)
+{
+    Arena* arena = create_arena_with_flags(HUGE_ARENA_SIZE, page_flags);
+    if (!arena) {
+        printf("  %s: cannot create arena\n", name);
+        return;
+    }
+    size_t num_words = HUGE_ARENA_SIZE / sizeof(uint64_t) / 2;
+    uint64_t* data = _arena_alloc(arena, num_words * sizeof(uint64_t), alignof(uint64_t));
+    for (size_t i = 0; i < num_words; i++) {
+        data[i] = i;
+    }
+    uint64_t x = 88172645463325252ull;
+    uint64_t sum = 0;
+    double start = bench_now();
+    for (unsigned i = 0; i < HUGE_NUM_READS; i++) {
+        // xorshift64
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        sum += data[x % num_words];
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%s (obtained %u)", name, arena_page_flags(arena));
+    bench_report(label, bench_now() - start, HUGE_NUM_READS);
+    if (sum == 0) {
+        printf("?\n");  // keep the loop
+    }
+    delete_arena(arena);
+}
+
+void bench_huge_pages()
+{
+    random_reads("random reads, 4K pages", 0);
+    random_reads("random reads, PAGES_HUGE", PAGES_HUGE);
+    random_reads("random reads, PAGES_HUGETLB", PAGES_HUGETLB);
+}
@@ -0,0 +1,316 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include "allocator.h"
+#include "bench.h"
+#include "fsb_arena.h"
+
+/****************************************************************
+ * SyncFsbArena with per-thread magazines against FsbArena wrapped in mutex.
+ *
+ * Each thread allocates a working set of blocks and releases them,
+ * the total number of allocations is the same for any number of threads.
+ * One operation is allocation and release of a block.
+ */
+
+typedef struct {
+    uint64_t data[8];
+} Block64;
+
+#define MAGAZINE_TOTAL_OPS    (4 * 1024 * 1024)
+#define MAGAZINE_WORKING_SET  256
+#define MAGAZINE_MAX_THREADS  64
+
+typedef struct {
+    SyncFsbArena* sfa;
+    FsbArena* arena;
+    mtx_t* lock;
+    unsigned num_ops;
+} MagazineTask;
+
+static int sfa_worker(void* arg)
+{
+    MagazineTask* task = arg;
+    void* blocks[MAGAZINE_WORKING_SET];
+    for (unsigned n = 0; n < task->num_ops; n += MAGAZINE_WORKING_SET) {
+        for (unsigned i = 0; i < MAGAZINE_WORKING_SET; i++) {
+            blocks[i] = sfa_allocate(task->sfa);
+            if (!blocks[i]) {
+                abort();
+            }
+        }
+        for (unsigned i = 0; i < MAGAZINE_WORKING_SET; i++) {
+            sfa_free(task->sfa, &blocks[i]);
+        }
+    }
+    return 0;
+}
+
+static int locked_fsb_worker(void* arg)
+{
+    MagazineTask* task = arg;
+    void* blocks[MAGAZINE_WORKING_SET];
+    for (unsigned n = 0; n < task->num_ops; n += MAGAZINE_WORKING_SET) {
+        for (unsigned i = 0; i < MAGAZINE_WORKING_SET; i++) {
+            mtx_lock(task->lock);
+            blocks[i] = fsb_arena_allocate(task->arena);
+            mtx_unlock(task->lock);
+            if (!blocks[i]) {
+                abort();
+            }
+        }
+        for (unsigned i = 0; i < MAGAZINE_WORKING_SET; i++) {
+            mtx_lock(task->lock);
+            fsb_arena_free(task->arena, &blocks[i]);
+            mtx_unlock(task->lock);
+        }
+    }
+    return 0;
+}
+
+static void run_magazine_threads(const char* name, unsigned num_threads, thrd_start_t worker, MagazineTask* task)
+{
+    thrd_t threads[MAGAZINE_MAX_THREADS];
+    double start = bench_now();
+    for (unsigned i = 0; i < num_threads; i++) {
+        if (thrd_create(&threads[i], worker, task) != thrd_success) {
+            abort();
+        }
+    }
+    for (unsigned i = 0; i < num_threads; i++) {
+        thrd_join(threads[i], nullptr);
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%s, %u threads", name, num_threads);
+    bench_report(label, bench_now() - start, task->num_ops * num_threads);
+}
+
+void bench_fsb_magazines()
+{
+    for (unsigned num_threads = 1; num_threads <= MAGAZINE_MAX_THREADS; num_threads *= 2) {
+        MagazineTask task = { .num_ops = MAGAZINE_TOTAL_OPS / num_threads };
+
+        SyncFsbArena sfa;
+        sfa_init(&sfa, Block64, 0);
+        task.sfa = &sfa;
+        run_magazine_threads("SyncFsbArena", num_threads, sfa_worker, &task);
+        sfa_fini(&sfa);
+
+        FsbArena arena;
+        mtx_t lock;
+        init_fsb_arena(&arena, Block64);
+        mtx_init(&lock, mtx_plain);
+        task.arena = &arena;
+        task.lock = &lock;
+        run_magazine_threads("FsbArena with mutex", num_threads, locked_fsb_worker, &task);
+        mtx_destroy(&lock);
+        destroy_fsb_arena(&arena);
+    }
+}
+
+/****************************************************************
+ * Allocation of 16-byte blocks with first free word hint.
+ *
+ * The time is reported per quarter of page fill: with the hint it does
+ * not grow as the page fills up, without it the bitmap is scanned from word 0.
+ * Single-page slab has a few bitmap words, 64K slab has 64 words on 64-bit systems.
+ * The first quarter includes mapping and faulting in new page.
+ */
+
+#define FIRST_FREE_MEM_SIZE  (16 * 1024 * 1024)
+
+static void run_first_free(unsigned slab_size, bool hint)
+{
+    FsbArena arena;
+    if (!_init_fsb_arena_with_slab_size(&arena, 16, 16, slab_size)) {
+        abort();
+    }
+    arena.first_free_hint = hint;
+    unsigned blocks_per_page = arena.blocks_per_page;
+    unsigned quarter = blocks_per_page / 4;
+    unsigned num_pages = FIRST_FREE_MEM_SIZE / slab_size;
+
+    double elapsed[4] = {};
+    for (unsigned p = 0; p < num_pages; p++) {
+        for (unsigned q = 0; q < 4; q++) {
+            unsigned n = (q < 3)? quarter : blocks_per_page - 3 * quarter;
+            double start = bench_now();
+            for (unsigned i = 0; i < n; i++) {
+                if (!fsb_arena_allocate(&arena)) {
+                    abort();
+                }
+            }
+            elapsed[q] += bench_now() - start;
+        }
+    }
+    printf("  slab %u bytes, %u blocks per page, bitmap %u words, hint %s\n",
+           arena.slab_size, blocks_per_page, arena.bitmap_size, hint? "on" : "off");
+    for (unsigned q = 0; q < 4; q++) {
+        unsigned n = (q < 3)? quarter : blocks_per_page - 3 * quarter;
+        char label[64];
+        snprintf(label, sizeof(label), "fsb_arena_allocate, page fill quarter %u", q + 1);
+        bench_report(label, elapsed[q], ((size_t) n) * num_pages);
+    }
+    destroy_fsb_arena(&arena);
+}
+
+void bench_fsb_first_free()
+{
+    unsigned slab_sizes[] = { sys_page_size, 65536 };
+    for (unsigned i = 0; i < 2; i++) {
+        run_first_free(slab_sizes[i], true);
+        run_first_free(slab_sizes[i], false);
+    }
+}
+
+/****************************************************************
+ * Cache coloring.
+ *
+ * First blocks of pages are linked into a ring and traversed
+ * by pointer chasing. Without coloring they all have the same page offset
+ * and map to the same L1 cache set, so the ring misses L1
+ * as soon as the number of pages exceeds L1 associativity.
+ */
+
+// slab is pinned to a single page: 1500 bytes aligned at cache line take 1536,
+// two blocks per 4K page leave 960 bytes of slack for 16 colors
+#define COLORING_BLOCK_SIZE  1500
+#define COLORING_NUM_STEPS   (16 * 1024 * 1024)
+
+static void init_coloring_arena(FsbArena* arena, bool coloring)
+{
+    if (!_init_fsb_arena_with_slab_size(arena, COLORING_BLOCK_SIZE, FSB_CACHE_LINE_SIZE, sys_page_size)) {
+        abort();
+    }
+    fsb_arena_set_coloring(arena, coloring);
+}
+
+static void chase_first_blocks(unsigned num_pages, bool coloring)
+{
+    FsbArena arena;
+    init_coloring_arena(&arena, coloring);
+
+    unsigned blocks_per_page = arena.blocks_per_page;
+    void*** first_blocks = malloc(sizeof(void**) * num_pages);
+    for (unsigned p = 0; p < num_pages; p++) {
+        for (unsigned i = 0; i < blocks_per_page; i++) {
+            void** block = fsb_arena_allocate(&arena);
+            if (!block) {
+                abort();
+            }
+            if (i == 0) {
+                first_blocks[p] = block;
+            }
+        }
+    }
+    for (unsigned p = 0; p < num_pages; p++) {
+        *first_blocks[p] = first_blocks[(p + 1) % num_pages];
+    }
+    void** block = first_blocks[0];
+    double start = bench_now();
+    for (unsigned i = 0; i < COLORING_NUM_STEPS; i++) {
+        block = *block;
+    }
+    double elapsed = bench_now() - start;
+
+    char label[64];
+    snprintf(label, sizeof(label), "%u pages, %u colors", num_pages, arena.num_colors);
+    bench_report(label, elapsed, COLORING_NUM_STEPS);
+    if (!block) {
+        printf("?\n");  // keep the loop
+    }
+    free(first_blocks);
+    destroy_fsb_arena(&arena);
+}
+
+void bench_fsb_coloring()
+{
+    FsbArena arena;
+    init_coloring_arena(&arena, true);
+    printf("  slab %u bytes, %u blocks of %u bytes per page, %u colors\n",
+           arena.slab_size, arena.blocks_per_page, arena.block_size, arena.num_colors);
+    destroy_fsb_arena(&arena);
+
+    for (unsigned num_pages = 8; num_pages <= 256; num_pages *= 2) {
+        chase_first_blocks(num_pages, false);
+        chase_first_blocks(num_pages, true);
+    }
+}
+
+/****************************************************************
+ * Object pool with constructor caching against initialization
+ * of each allocated object.
+ */
+
+typedef struct {
+    mtx_t lock;
+    cnd_t cond;
+    void* list_head;
+    uint64_t counters[8];
+} PoolObject;
+
+#define POOL_NUM_OPS       (4 * 1024 * 1024)
+#define POOL_WORKING_SET   256
+
+static void construct_object(void* block, void* hook_data)
+{
+    PoolObject* obj = block;
+    mtx_init(&obj->lock, mtx_plain);
+    cnd_init(&obj->cond);
+    obj->list_head = nullptr;
+    for (unsigned i = 0; i < 8; i++) {
+        obj->counters[i] = 0;
+    }
+}
+
+static void destruct_object(void* block, void* hook_data)
+{
+    PoolObject* obj = block;
+    cnd_destroy(&obj->cond);
+    mtx_destroy(&obj->lock);
+}
+
+DEFINE_FSB_POOL(ObjectPool, PoolObject)
+
+void bench_fsb_pool()
+{
+    PoolObject* objects[POOL_WORKING_SET];
+
+    ObjectPool pool;
+    init_ObjectPool(&pool, construct_object, destruct_object, nullptr);
+    double start = bench_now();
+    for (unsigned n = 0; n < POOL_NUM_OPS; n += POOL_WORKING_SET) {
+        for (unsigned i = 0; i < POOL_WORKING_SET; i++) {
+            objects[i] = ObjectPool_allocate(&pool);
+            mtx_lock(&objects[i]->lock);
+            objects[i]->counters[0]++;
+            mtx_unlock(&objects[i]->lock);
+        }
+        for (unsigned i = 0; i < POOL_WORKING_SET; i++) {
+            ObjectPool_release(&pool, &objects[i]);
+        }
+    }
+    bench_report("pool with constructor caching", bench_now() - start, POOL_NUM_OPS);
+    destroy_ObjectPool(&pool);
+
+    FsbArena arena;
+    init_fsb_arena(&arena, PoolObject);
+    start = bench_now();
+    for (unsigned n = 0; n < POOL_NUM_OPS; n += POOL_WORKING_SET) {
+        for (unsigned i = 0; i < POOL_WORKING_SET; i++) {
+            objects[i] = fsb_arena_allocate(&arena);
+            construct_object(objects[i], nullptr);
+            mtx_lock(&objects[i]->lock);
+            objects[i]->counters[0]++;
+            mtx_unlock(&objects[i]->lock);
+        }
+        for (unsigned i = 0; i < POOL_WORKING_SET; i++) {
+            destruct_object(objects[i], nullptr);
+            fsb_arena_free(&arena, (void**) &objects[i]);
+        }
+    }
+    bench_report("arena with initialization on each use", bench_now() - start, POOL_NUM_OPS);
+    destroy_fsb_arena(&arena);
+}
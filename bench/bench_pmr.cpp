@@ -0,0 +1,86 @@
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "bench.h"
+#include "memory_resource.hpp"
+
+/*
+ * Standard containers on libpussy memory resources
+ * against the default new/delete resource.
+ */
+
+static constexpr unsigned NUM_ROUNDS = 20;
+static constexpr unsigned NUM_ELEMENTS = 100000;
+
+static void run_vector(const char* name, std::pmr::memory_resource* resource)
+{
+    double start = bench_now();
+    unsigned long sum = 0;
+    for (unsigned round = 0; round < NUM_ROUNDS; round++) {
+        std::pmr::vector<unsigned> v(resource);
+        for (unsigned i = 0; i < NUM_ELEMENTS; i++) {
+            v.push_back(i);
+        }
+        sum += v.back();
+    }
+    bench_report(name, bench_now() - start, NUM_ROUNDS * NUM_ELEMENTS);
+    if (sum == 0) {
+        printf("?\n");  // keep the loop
+    }
+}
+
+static void run_map(const char* name, std::pmr::memory_resource* resource)
+{
+    double start = bench_now();
+    unsigned long sum = 0;
+    for (unsigned round = 0; round < NUM_ROUNDS; round++) {
+        std::pmr::unordered_map<unsigned, unsigned> m(resource);
+        for (unsigned i = 0; i < NUM_ELEMENTS; i++) {
+            m[i * 2654435761u] = i;
+        }
+        sum += m.size();
+    }
+    bench_report(name, bench_now() - start, NUM_ROUNDS * NUM_ELEMENTS);
+    if (sum == 0) {
+        printf("?\n");
+    }
+}
+
+template <typename Fn>
+static void run_all(Fn fn, const char* names[4])
+{
+    fn(names[0], std::pmr::new_delete_resource());
+    {
+        // monotonic resource keeps memory of all rounds until it is destroyed
+        pussy::ArenaResource arena_resource(1024 * 1024);
+        fn(names[1], &arena_resource);
+    }
+    {
+        pussy::FsbPoolResource fsb_resource;
+        fn(names[2], &fsb_resource);
+    }
+    {
+        pussy::AllocatorResource pet_resource(&pet_allocator);
+        fn(names[3], &pet_resource);
+    }
+}
+
+void bench_pmr()
+{
+    const char* vector_names[4] = {
+        "vector push_back: new_delete_resource",
+        "vector push_back: ArenaResource",
+        "vector push_back: FsbPoolResource",
+        "vector push_back: AllocatorResource(pet)"
+    };
+    run_all(run_vector, vector_names);
+
+    const char* map_names[4] = {
+        "unordered_map insert: new_delete_resource",
+        "unordered_map insert: ArenaResource",
+        "unordered_map insert: FsbPoolResource",
+        "unordered_map insert: AllocatorResource(pet)"
+    };
+    run_all(run_map, map_names);
+}
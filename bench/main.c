@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "bench.h"
+
+/*
+ * Usage: pussy_bench [name...]
+ *
+ * Run all benchmarks or only those given on command line.
+ */
+
+typedef struct {
+    const char* name;
+    void (*run)();
+} Benchmark;
+
+static Benchmark benchmarks[] = {
+    { "pmr",            bench_pmr },
+    { "arena_fit",      bench_arena_fit },
+    { "sync_arena",     bench_sync_arena },
+    { "huge_pages",     bench_huge_pages },
+    { "fsb_magazines",  bench_fsb_magazines },
+    { "fsb_first_free", bench_fsb_first_free },
+    { "fsb_coloring",   bench_fsb_coloring },
+    { "fsb_pool",       bench_fsb_pool },
+    { "allocators",     bench_allocators },
+};
+
+#define NUM_BENCHMARKS  (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static void run(Benchmark* benchmark)
+{
+    printf("%s:\n", benchmark->name);
+    benchmark->run();
+}
+
+int main(int argc, char* argv[])
+{
+    init_allocator(&pet_allocator);
+
+    if (argc < 2) {
+        for (unsigned i = 0; i < NUM_BENCHMARKS; i++) {
+            run(&benchmarks[i]);
+        }
+        return 0;
+    }
+    for (int a = 1; a < argc; a++) {
+        unsigned i = 0;
+        while (i < NUM_BENCHMARKS && strcmp(benchmarks[i].name, argv[a]) != 0) {
+            i++;
+        }
+        if (i == NUM_BENCHMARKS) {
+            fprintf(stderr, "Unknown benchmark %s\n", argv[a]);
+            return 1;
+        }
+        run(&benchmarks[i]);
+    }
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <unistd.h>
 
 #ifdef __cplusplus
@@ -31,10 +32,65 @@ typedef bool  (*FnReallocate)(void** addr_ptr, unsigned old_nbytes, unsigned new
 typedef void  (*FnRelease)   (void** addr_ptr, unsigned nbytes);
 typedef void  (*FnDump)();
 
+/*
+ * Allocation tags make possible to tell which subsystem the memory belongs to.
+ *
+ * Allocators take the tag from thread-local `allocation_tag` variable
+ * and account blocks and bytes per tag. Tag 0 is used by default.
+ *
+ * Similar to the number of bytes, the tag passed to release()
+ * must be the same as the one used for allocation.
+ */
+
+#define NUM_ALLOCATION_TAGS  16  // must be a power of two
+
+extern thread_local unsigned allocation_tag;
+
 typedef struct {
     atomic_size_t blocks_allocated;
+    atomic_size_t bytes_allocated;
+} AllocationTagStats;
+
+typedef struct {
+    atomic_size_t blocks_allocated;
+    AllocationTagStats tags[NUM_ALLOCATION_TAGS];
 } AllocatorStats;
 
+/*
+ * Memory budget.
+ *
+ * Allocators account memory they obtain from the system
+ * (or from underlying allocator) in `bytes_in_use`.
+ *
+ * When `bytes_in_use` crosses the soft limit, pressure callbacks are called
+ * so caches can shed their entries.
+ *
+ * When an allocation would exceed the hard limit, pressure callbacks are called
+ * with `hard_limit` argument set to true. If that did not help,
+ * the allocation fails.
+ *
+ * Zero limit means no limit.
+ */
+
+typedef void (*FnMemoryPressure)(void* cb_data, size_t bytes_in_use, bool hard_limit);
+
+#define MAX_PRESSURE_CALLBACKS  8
+
+typedef struct {
+    FnMemoryPressure callback;
+    void* cb_data;
+} PressureCallback;
+
+typedef struct {
+    atomic_size_t bytes_in_use;
+    atomic_size_t soft_limit;
+    atomic_size_t hard_limit;
+
+    atomic_flag lock;  // protects callbacks
+    unsigned num_callbacks;
+    PressureCallback callbacks[MAX_PRESSURE_CALLBACKS];
+} AllocatorBudget;
+
 typedef struct {
     FnInitAllocator init;  // optional, can be nullptr
     FnAllocate   allocate;
@@ -43,10 +99,12 @@ typedef struct {
     FnDump       dump;
 
     AllocatorStats* stats;
+    AllocatorBudget* budget;  // nullptr if not supported
 
     // optionally supported:
     bool verbose;
     bool trace;
+    unsigned page_flags;  // PAGES_* options for mapped pages, see pages.h
 
 } Allocator;
 
@@ -57,6 +115,16 @@ typedef struct {
 extern Allocator pet_allocator;
 extern Allocator stdlib_allocator;
 extern Allocator debug_allocator;  // checks if memory was damaged around the block
+extern Allocator fsb_allocator;    // size classes backed by fixed size block arenas, see fsb_arena.h
+
+unsigned pet_allocator_page_flags();
+/*
+ * Return PAGES_* options actually applied to all pages mapped by pet allocator,
+ * similar to `arena_page_flags`. Valid after initialization.
+ *
+ * PAGES_HUGE is reported when huge pages were obtained for all mappings
+ * not smaller than huge page size, smaller ones never get them.
+ */
 
 /****************************************************************
  * Alignment helpers.
@@ -103,6 +171,77 @@ static inline void* align_pointer_to_page(void* ptr)
     return align_pointer(ptr, sys_page_size);
 }
 
+/****************************************************************
+ * Stats helpers for allocator implementations.
+ *
+ * Per-tag counters are updated with relaxed memory order,
+ * they are for accounting purposes only.
+ */
+
+static inline AllocationTagStats* current_tag_stats(AllocatorStats* stats)
+{
+    return &stats->tags[allocation_tag & (NUM_ALLOCATION_TAGS - 1)];
+}
+
+static inline void stats_add_block(AllocatorStats* stats, unsigned nbytes)
+{
+    AllocationTagStats* tag_stats = current_tag_stats(stats);
+    atomic_fetch_add(&stats->blocks_allocated, 1);
+    atomic_fetch_add_explicit(&tag_stats->blocks_allocated, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&tag_stats->bytes_allocated, nbytes, memory_order_relaxed);
+}
+
+static inline void stats_sub_block(AllocatorStats* stats, unsigned nbytes)
+{
+    AllocationTagStats* tag_stats = current_tag_stats(stats);
+    atomic_fetch_sub(&stats->blocks_allocated, 1);
+    atomic_fetch_sub_explicit(&tag_stats->blocks_allocated, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&tag_stats->bytes_allocated, nbytes, memory_order_relaxed);
+}
+
+static inline void stats_resize_block(AllocatorStats* stats, unsigned old_nbytes, unsigned new_nbytes)
+{
+    AllocationTagStats* tag_stats = current_tag_stats(stats);
+    if (new_nbytes > old_nbytes) {
+        atomic_fetch_add_explicit(&tag_stats->bytes_allocated, new_nbytes - old_nbytes, memory_order_relaxed);
+    } else {
+        atomic_fetch_sub_explicit(&tag_stats->bytes_allocated, old_nbytes - new_nbytes, memory_order_relaxed);
+    }
+}
+
+void dump_allocation_tags(FILE* fp, Allocator* allocator);
+/*
+ * Print non-zero per-tag counters of `allocator`.
+ */
+
+bool budget_charge(AllocatorBudget* budget, size_t nbytes);
+/*
+ * Account `nbytes` in the budget before obtaining memory.
+ * Return false if the hard limit is exceeded.
+ */
+
+void budget_uncharge(AllocatorBudget* budget, size_t nbytes);
+/*
+ * Account `nbytes` returned back.
+ */
+
+/****************************************************************
+ * Memory budget functions.
+ */
+
+void set_allocator_budget(Allocator* allocator, size_t soft_limit, size_t hard_limit);
+
+bool add_pressure_callback(Allocator* allocator, FnMemoryPressure callback, void* cb_data);
+/*
+ * Register pressure callback.
+ * Return false if the allocator does not support budget or there are too many callbacks.
+ *
+ * Callbacks may release memory but should not allocate it:
+ * nested allocations do not trigger callbacks.
+ */
+
+void remove_pressure_callback(Allocator* allocator, FnMemoryPressure callback, void* cb_data);
+
 /****************************************************************
  * Default allocator and shorthand wrappers.
  */
@@ -132,6 +271,43 @@ static inline void release(void** addr_ptr, unsigned nbytes)
     default_allocator.release(addr_ptr, nbytes);
 }
 
+/*
+ * Tagged wrappers temporarily switch `allocation_tag`.
+ */
+
+static inline unsigned set_allocation_tag(unsigned tag)
+/*
+ * Set current tag for the calling thread, return previous one.
+ */
+{
+    unsigned prev_tag = allocation_tag;
+    allocation_tag = tag;
+    return prev_tag;
+}
+
+static inline void* allocate_tagged(unsigned tag, unsigned nbytes, bool clean)
+{
+    unsigned prev_tag = set_allocation_tag(tag);
+    void* result = default_allocator.allocate(nbytes, clean);
+    allocation_tag = prev_tag;
+    return result;
+}
+
+static inline bool reallocate_tagged(unsigned tag, void** addr_ptr, unsigned old_nbytes, unsigned new_nbytes, bool clean, bool* addr_changed)
+{
+    unsigned prev_tag = set_allocation_tag(tag);
+    bool result = default_allocator.reallocate(addr_ptr, old_nbytes, new_nbytes, clean, addr_changed);
+    allocation_tag = prev_tag;
+    return result;
+}
+
+static inline void release_tagged(unsigned tag, void** addr_ptr, unsigned nbytes)
+{
+    unsigned prev_tag = set_allocation_tag(tag);
+    default_allocator.release(addr_ptr, nbytes);
+    allocation_tag = prev_tag;
+}
+
 #ifdef __cplusplus
 }
 #endif
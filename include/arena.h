@@ -20,14 +20,51 @@ Arena* create_arena(unsigned capacity);
  * the same capacity unless adjusted with `set_region_capacity`.
  */
 
+Arena* create_arena_with_flags(unsigned capacity, unsigned page_flags);
+/*
+ * Same as `create_arena` with PAGES_* options from pages.h
+ * applied to all regions.
+ */
+
+Arena* create_contiguous_arena(size_t reserve_size, unsigned page_flags);
+/*
+ * Create arena that occupies single contiguous range of address space.
+ *
+ * The range is reserved up front and pages are committed
+ * as allocations advance. Such arena never creates new regions,
+ * allocation fails when reserved space is exhausted.
+ *
+ * With PAGES_HUGE pages are committed in huge page steps.
+ * PAGES_HUGETLB is not supported and is treated as PAGES_HUGE.
+ * PAGES_POPULATE and PAGES_LOCK are applied to pages as they are committed.
+ */
+
 void delete_arena(Arena* arena);
 /*
  * Free arena and all its regions.
  */
 
+typedef enum {
+    ARENA_GROWTH_FIXED,     // all regions have the same capacity
+    ARENA_GROWTH_DOUBLING,  // each new region is twice as big as previous one
+    ARENA_GROWTH_FIBONACCI  // capacity of new region is the sum of two previous ones
+} ArenaGrowthPolicy;
+
 void set_region_capacity(Arena* arena, unsigned capacity);
 /*
- * Set desired capacity for newly created regions.
+ * Set desired capacity for the next new region.
+ */
+
+void set_region_growth(Arena* arena, ArenaGrowthPolicy policy, unsigned max_capacity);
+/*
+ * Set how capacity grows with each new region, up to `max_capacity`.
+ * The growth starts from current region capacity.
+ * Default policy is ARENA_GROWTH_FIXED.
+ */
+
+unsigned arena_page_flags(Arena* arena);
+/*
+ * Return PAGES_* options actually applied to all regions of arena.
  */
 
 void* _arena_alloc(Arena* arena, unsigned size, unsigned alignment);
@@ -59,8 +96,198 @@ void* _arena_fit(Arena* arena, unsigned size, unsigned element_size);
 #define arena_fit(arena, num_elements, element_type) \
     _arena_fit((arena), (num_elements) * sizeof(element_type), alignof(element_type))
 
+/*
+ * Checkpoints.
+ */
+
+typedef struct {
+    struct _Region* region;
+    size_t tail;
+} ArenaMark;
+
+typedef enum {
+    ARENA_KEEP_REGIONS,     // keep subsequent regions for reuse
+    ARENA_DISCARD_REGIONS,  // keep subsequent regions mapped but release their pages with MADV_DONTNEED
+    ARENA_FREE_REGIONS      // unmap subsequent regions
+} ArenaRewindMode;
+
+ArenaMark arena_mark(Arena* arena);
+/*
+ * Remember current position in the arena.
+ */
+
+void arena_rewind(Arena* arena, ArenaMark mark, ArenaRewindMode mode);
+/*
+ * Release everything allocated with `_arena_alloc` after `mark`.
+ *
+ * Blocks placed in preceding regions by `_arena_fit` after the mark
+ * are not released. Blocks placed by `_arena_fit` before the mark
+ * are always kept.
+ */
+
+void arena_reset(Arena* arena, size_t max_retained_bytes);
+/*
+ * Make all regions empty, keeping them mapped for reuse.
+ *
+ * If `max_retained_bytes` is nonzero, pages of regions beyond that limit
+ * are released with MADV_DONTNEED. Regions are counted in their order.
+ */
+
+bool arena_extend(Arena* arena, void* block, unsigned old_size, unsigned new_size);
+/*
+ * Grow or shrink the most recent allocation in place.
+ * Return false if `block` is not the most recent allocation
+ * or there is no space available.
+ */
+
+void* arena_resize(Arena* arena, void* block, unsigned old_size, unsigned new_size, unsigned alignment);
+/*
+ * Resize block in place if it is the most recent allocation,
+ * otherwise allocate new block and copy data.
+ * Shrinking never moves the block.
+ *
+ * Return new address of block or nullptr if allocation failed.
+ */
+
+/*
+ * Growable vector in arena.
+ *
+ * Vector grows in place while it is the most recent allocation,
+ * this makes incremental building of strings and arrays cheap.
+ */
+
+#define ARENA_VECTOR_MIN_CAPACITY  16  // in elements
+
+typedef struct {
+    Arena* arena;
+    void* data;
+    unsigned length;    // in elements
+    unsigned capacity;  // in elements
+    unsigned element_size;
+    unsigned alignment;
+} ArenaVector;
+
+void _init_arena_vector(ArenaVector* vector, Arena* arena, unsigned element_size, unsigned alignment);
+
+#define init_arena_vector(vector, arena, element_type) \
+    _init_arena_vector((vector), (arena), sizeof(element_type), alignof(element_type))
+
+bool arena_vector_reserve(ArenaVector* vector, unsigned capacity);
+
+void* arena_vector_append(ArenaVector* vector, unsigned num_elements);
+/*
+ * Grow vector by `num_elements`.
+ * Return pointer to the first new element or nullptr if allocation failed.
+ */
+
+bool arena_vector_append_data(ArenaVector* vector, void* data, unsigned num_elements);
+/*
+ * Append `num_elements` from `data`.
+ */
+
+void arena_vector_shrink_to_fit(ArenaVector* vector);
+/*
+ * Give unused capacity back to the arena if possible.
+ */
+
+#define arena_vector_item(vector, index, element_type)  (((element_type*) (vector)->data)[index])
+
+/*
+ * Statistics.
+ */
+
+typedef struct {
+    // cumulative
+    size_t total_requested;        // bytes requested by allocations and growth of blocks with `arena_extend`
+    size_t total_alignment_waste;  // bytes skipped to align blocks
+    size_t num_allocations;
+
+    // current
+    size_t bytes_used;        // sum of region tails, including alignment waste
+    size_t tail_waste;        // free space left in regions preceding the last one
+    size_t capacity;          // sum of region capacities, including regions retained by rewind and reset
+    unsigned num_regions;
+    size_t high_water_mark;   // maximal bytes_used observed across rewinds and resets
+    size_t mmap_calls;        // number of regions mapped during arena lifetime
+} ArenaStats;
+
+ArenaStats arena_stats(Arena* arena);
+/*
+ * Collect arena statistics.
+ * This function walks all regions, don't call it in tight loops.
+ */
+
+/*
+ * Snapshots.
+ *
+ * Contiguous arena can be saved to file and mapped back later.
+ * Because the arena may be mapped at a different address,
+ * data structures in it should refer to each other by offsets
+ * relative to the beginning of arena.
+ */
+
+typedef size_t ArenaOffset;  // zero stands for null pointer
+
+static inline ArenaOffset arena_offset(Arena* arena, void* ptr)
+{
+    return ptr? (ArenaOffset) (((char*) ptr) - ((char*) arena)) : 0;
+}
+
+static inline void* arena_pointer(Arena* arena, ArenaOffset offset)
+{
+    return offset? ((char*) arena) + offset : nullptr;
+}
+
+bool arena_save(Arena* arena, const char* path);
+/*
+ * Write used part of contiguous arena to file.
+ *
+ * The file is replaced atomically with rename, so a writable arena
+ * can be saved back to the file it was opened from.
+ * Data and directory entry are flushed with fsync before returning.
+ *
+ * Return false on error.
+ */
+
+Arena* arena_open(const char* path, bool writable);
+/*
+ * Map arena snapshot from file.
+ *
+ * Read-only arena can be accessed with `arena_pointer` and must not
+ * be passed to other functions except `delete_arena`.
+ * Writable arena is a copy-on-write mapping of the file: allocations
+ * and modifications are private to the process and never written back,
+ * use `arena_save` to persist them.
+ *
+ * Snapshots are not portable across architectures and library versions.
+ *
+ * Return nullptr on error.
+ */
+
 void arena_print(FILE* fp, Arena* arena);
 
+/****************************************************************
+ * Arena with synchronization
+ */
+
+typedef struct _SyncArena SyncArena;
+/*
+ * Thread-safe arena.
+ *
+ * Small blocks are allocated from the current chunk
+ * by atomic increment of the chunk tail.
+ * The lock is taken only to allocate new chunk
+ * and for blocks bigger than a quarter of chunk.
+ */
+
+SyncArena* create_sync_arena(unsigned chunk_size);
+void delete_sync_arena(SyncArena* sarena);
+
+void* _sync_arena_alloc(SyncArena* sarena, unsigned size, unsigned alignment);
+
+#define sync_arena_alloc(sarena, num_elements, element_type) \
+    _sync_arena_alloc((sarena), (num_elements) * sizeof(element_type), alignof(element_type))
+
 #ifdef __cplusplus
 }
 #endif
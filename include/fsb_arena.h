@@ -1,5 +1,11 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+#include "allocator.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -7,34 +13,279 @@ extern "C" {
 struct _FsbaPageHeader;
 typedef struct _FsbaPageHeader FsbaPageHeader;
 
+typedef void (*FsbBlockHook)(void* block, void* hook_data);
+
 typedef struct {
-    unsigned block_size;         // block alignment equals to block_size
-    unsigned blocks_per_page;    // ??? (sys_page_size - align(sizeof(FsbArena) + bitmap_size * sizeof(WORD), block_size)) / block_size
+    unsigned block_size;         // multiple of block_alignment
+    unsigned block_alignment;
+    unsigned slab_size;          // size of page in bytes: power of two number of system pages
+    unsigned blocks_per_page;    // (slab_size - align(sizeof(FsbaPageHeader) + bitmap_size * sizeof(Word), block_alignment)) / block_size
     unsigned bitmap_size;        // in words
+    unsigned header_size;        // page header size including bitmap, aligned at block_alignment
     FsbaPageHeader* avail_pages; // list of pages with free blocks, one page is always allocated
     FsbaPageHeader* full_pages;  // list of full pages
+    bool first_free_hint;        // start bitmap scan from the first word that may have free bits, true by default
+
+    unsigned max_empty_pages;    // number of empty pages to retain instead of unmapping, zero by default;
+                                 // the last available page is always kept and is not counted
+    unsigned num_empty_pages;    // number of retained empty pages
+
+    // page mapping statistics
+    size_t mmap_calls;
+    size_t munmap_calls;
+    size_t pages_reused;         // retained empty pages reused, each saved one mmap and one munmap
+
+    // cache coloring
+    unsigned color_step;         // max(FSB_CACHE_LINE_SIZE, block_alignment)
+    unsigned num_colors;         // 1 if coloring is disabled
+    unsigned next_color;
+
+    // object pool hooks, called for each block when page is created and unmapped
+    FsbBlockHook ctor;
+    FsbBlockHook dtor;
+    void* hook_data;
+
+    // handle mode
+    void* page_table;            // mmarray of page pointers, nullptr if handles are not enabled
+    unsigned slot_bits;          // number of bits for block index in handle
 } FsbArena;
 
 
 bool _init_fsb_arena(FsbArena* arena, unsigned block_size, unsigned block_alignment);
+/*
+ * Initialize arena. Page (slab) size is the system page size if the block fits in it,
+ * otherwise it is chosen as for FSB_AUTO_SLAB_SIZE.
+ * Return false if the block is too big.
+ */
 
 #define init_fsb_arena(arena, data_type)  _init_fsb_arena((arena), sizeof(data_type), alignof(data_type))
 
+#define FSB_AUTO_SLAB_SIZE  0
+
+bool _init_fsb_arena_with_slab_size(FsbArena* arena, unsigned block_size, unsigned block_alignment, unsigned slab_size);
+/*
+ * Initialize arena with `slab_size` which must be a power of two multiple
+ * of the system page size, up to 1 MB.
+ *
+ * FSB_AUTO_SLAB_SIZE chooses the smallest slab that keeps waste within 1/8,
+ * which allows blocks of up to several hundred kilobytes.
+ *
+ * Blocks of multi-page slabs can't be released with `fsb_arena_release`.
+ * Return false if the block does not fit in the slab.
+ */
+
+#define init_fsb_arena_with_slab_size(arena, data_type, slab_size)  \
+    _init_fsb_arena_with_slab_size((arena), sizeof(data_type), alignof(data_type), (slab_size))
+
+/*
+ * Object pool.
+ *
+ * Constructor is called for all blocks of a page when the page is created
+ * and destructor is called when the page is unmapped or the arena is destroyed.
+ * Released objects should be returned in constructed state,
+ * this way expensive initialization is done only once per block.
+ *
+ * Pools retain all empty pages, use `fsb_arena_trim` or set `max_empty_pages`
+ * to give memory back.
+ */
+
+bool _init_fsb_pool(FsbArena* arena, unsigned block_size, unsigned block_alignment,
+                    FsbBlockHook ctor, FsbBlockHook dtor, void* hook_data);
+
+#define init_fsb_pool(arena, data_type, ctor, dtor, hook_data)  \
+    _init_fsb_pool((arena), sizeof(data_type), alignof(data_type), (ctor), (dtor), (hook_data))
+
+#define DEFINE_FSB_POOL(pool_name, data_type)  \
+    typedef struct { FsbArena arena; } pool_name;  \
+    \
+    static inline bool init_##pool_name(pool_name* pool, FsbBlockHook ctor, FsbBlockHook dtor, void* hook_data)  \
+    {  \
+        return init_fsb_pool(&pool->arena, data_type, ctor, dtor, hook_data);  \
+    }  \
+    static inline void destroy_##pool_name(pool_name* pool)  \
+    {  \
+        destroy_fsb_arena(&pool->arena);  \
+    }  \
+    static inline data_type* pool_name##_allocate(pool_name* pool)  \
+    {  \
+        return (data_type*) fsb_arena_allocate(&pool->arena);  \
+    }  \
+    static inline void pool_name##_release(pool_name* pool, data_type** obj_ptr)  \
+    {  \
+        fsb_arena_free(&pool->arena, (void**) obj_ptr);  \
+    }
+
+#define FSB_CACHE_LINE_SIZE  64
+
+void fsb_arena_set_coloring(FsbArena* arena, bool enable);
+/*
+ * Enable or disable cache coloring for new pages.
+ *
+ * Without coloring the first block of each page has the same offset,
+ * so hot first blocks of all pages compete for the same cache sets.
+ * With coloring, the offset of the first block is rotated across pages
+ * in cache line steps within the slack left at the end of page.
+ * Disabled by default.
+ */
+
+/*
+ * Handle mode.
+ *
+ * Blocks can be referred by 32-bit handles instead of pointers.
+ * Handle consists of page index, block index, and 8-bit generation
+ * which is incremented when the block is released, to detect stale handles.
+ * Page index and block index take FSB_HANDLE_INDEX_BITS together,
+ * this limits the number of pages in the arena.
+ * Zero handle is never returned for valid blocks.
+ *
+ * Pages are never unmapped in handle mode until the arena is destroyed.
+ */
+
+typedef uint32_t FsbHandle;
+
+#define FSB_HANDLE_INDEX_BITS  24
+
+bool _init_fsb_arena_with_handles(FsbArena* arena, unsigned block_size, unsigned block_alignment);
+
+#define init_fsb_arena_with_handles(arena, data_type)  \
+    _init_fsb_arena_with_handles((arena), sizeof(data_type), alignof(data_type))
+
+FsbHandle fsb_arena_allocate_handle(FsbArena* arena);
+/*
+ * Allocate block and return its handle, zero if out of memory.
+ */
+
+bool fsb_arena_release_handle(FsbArena* arena, FsbHandle handle);
+/*
+ * Release block, return false if handle is stale or the block is not allocated.
+ */
+
+void* fsb_arena_handle_to_ptr(FsbArena* arena, FsbHandle handle);
+/*
+ * Return block address or nullptr if handle is stale or the block is not allocated.
+ */
+
+FsbHandle fsb_arena_ptr_to_handle(FsbArena* arena, void* block);
+
 void destroy_fsb_arena(FsbArena* arena);
 
 void* fsb_arena_allocate(FsbArena* arena);
+void fsb_arena_free(FsbArena* arena, void** block_ptr);
+/*
+ * Release block allocated from `arena`.
+ */
+
+unsigned fsb_arena_allocate_n(FsbArena* arena, unsigned n, void** blocks);
+/*
+ * Allocate up to `n` blocks and store them in `blocks`.
+ * Free bits of a bitmap word are claimed at once.
+ * Return the number of blocks allocated, less than `n` only if out of memory.
+ */
+
+void fsb_arena_release_n(FsbArena* arena, unsigned n, void** blocks);
+/*
+ * Release `n` blocks and set `blocks` elements to nullptr.
+ * Adjacent blocks that belong to the same page are released at once,
+ * as returned by `fsb_arena_allocate_n`.
+ */
+
+unsigned fsb_arena_trim(FsbArena* arena);
+/*
+ * Unmap all empty pages. Return the number of pages released.
+ */
+
 void fsb_arena_release(void** block_ptr);
+FsbArena* fsb_arena_of(void* block);
+/*
+ * Release block or get arena the block belongs to without knowing the arena.
+ * These functions work only for arenas with slab_size equal to system page size,
+ * which is the default for blocks that fit in a page.
+ */
 
 typedef void (*FsbArenaWalkCb)(FsbArena* arena, void* cb_data, void* block_ptr);
 
 void fsb_arena_walk(FsbArena* arena, FsbArenaWalkCb callback, void* cb_data);
 /*
  * Invoke `callback` for each allocated block.
- * The block can be released from the callback.
+ * The block can be released from the callback with `fsb_arena_free`.
+ */
+
+bool fsb_arena_walk_parallel(FsbArena* arena, FsbArenaWalkCb callback, void* cb_data, unsigned num_threads);
+/*
+ * Partition pages across `num_threads` threads, including the current one,
+ * and invoke `callback` for each allocated block.
+ *
+ * Callbacks run concurrently and must not allocate or release blocks
+ * in the arena.
+ *
+ * Return false if memory for the list of pages cannot be allocated.
  */
 
 void dump_fsb_arena(FsbArena* arena);
 
+/****************************************************************
+ * FSB arena with synchronization
+ *
+ * Each thread keeps a magazine of free blocks. Blocks are taken
+ * from the shared arena and returned back in batches under the lock,
+ * so most allocations and releases do not touch the lock.
+ *
+ * Blocks can be released from any thread.
+ * Each arena takes one thread-specific storage key.
+ */
+
+#define SFA_DEFAULT_BATCH_SIZE  32
+
+struct _FsbMagazine;
+
+typedef struct {
+    FsbArena arena;   // must be the first member, blocks refer to it
+    mtx_t    lock;    // protects arena and magazines list
+    tss_t    magazine_key;
+    unsigned batch_size;  // number of blocks to move between magazine and arena at once
+    struct _FsbMagazine* magazines;  // magazines of all threads
+    Allocator* magazine_allocator;   // nullptr means default allocator
+} SyncFsbArena;
+
+bool _sfa_init(SyncFsbArena* sfa, unsigned block_size, unsigned block_alignment, unsigned batch_size);
+/*
+ * Initialize arena. If `batch_size` is zero, SFA_DEFAULT_BATCH_SIZE is used.
+ */
+
+#define sfa_init(sfa, data_type, batch_size)  _sfa_init((sfa), sizeof(data_type), alignof(data_type), (batch_size))
+/*
+ * Magazines are allocated with default allocator.
+ * Allocators built on top of SyncFsbArena should set `magazine_allocator`
+ * after initialization to avoid recursion.
+ */
+
+bool _sfa_init_with_slab_size(SyncFsbArena* sfa, unsigned block_size, unsigned block_alignment,
+                              unsigned slab_size, unsigned batch_size);
+/*
+ * Initialize arena with explicit slab size, see `_init_fsb_arena_with_slab_size`.
+ */
+
+void sfa_fini(SyncFsbArena* sfa);
+/*
+ * Destroy arena with all magazines.
+ * Other threads must not use arena at this point.
+ */
+
+void* sfa_allocate(SyncFsbArena* sfa);
+void sfa_free(SyncFsbArena* sfa, void** block_ptr);
+
+void sfa_release(void** block_ptr);
+/*
+ * Release block without knowing the arena.
+ * Works only for arenas with single-page slabs, see `fsb_arena_release`.
+ */
+
+void sfa_flush(SyncFsbArena* sfa);
+/*
+ * Return blocks from the magazine of current thread to the arena.
+ * Magazines of exiting threads are flushed automatically.
+ */
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,258 @@
+#pragma once
+
+/*
+ * std::pmr::memory_resource implementations on top of libpussy allocators.
+ *
+ * Usage:
+ *
+ *   pussy::ArenaResource arena_resource(65536);
+ *   std::pmr::vector<int> v(&arena_resource);
+ */
+
+#include <climits>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+#include "allocator.h"
+#include "arena.h"
+#include "fsb_arena.h"
+
+namespace pussy {
+
+/****************************************************************
+ * Monotonic resource over Arena.
+ *
+ * Deallocation is no-op, memory is freed when the arena is deleted.
+ */
+
+class ArenaResource : public std::pmr::memory_resource {
+public:
+    explicit ArenaResource(unsigned capacity)
+        : arena(create_arena(capacity)), owns_arena(true)
+    {
+        if (!arena) {
+            throw std::bad_alloc();
+        }
+    }
+
+    explicit ArenaResource(Arena* arena)
+        : arena(arena), owns_arena(false)
+    {}
+
+    ArenaResource(const ArenaResource&) = delete;
+    ArenaResource& operator=(const ArenaResource&) = delete;
+
+    ~ArenaResource() override
+    {
+        if (owns_arena) {
+            delete_arena(arena);
+        }
+    }
+
+    Arena* get_arena() const noexcept
+    {
+        return arena;
+    }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        if (bytes == 0) {
+            bytes = 1;
+        }
+        void* result;
+        if (alignment <= alignof(std::max_align_t)) {
+            if (bytes > UINT_MAX) {
+                throw std::bad_alloc();
+            }
+            result = _arena_alloc(arena, bytes, alignment);
+        } else {
+            // arena does not align beyond max_align_t, allocate with extra space
+            if (bytes > UINT_MAX - alignment) {
+                throw std::bad_alloc();
+            }
+            result = _arena_alloc(arena, bytes + alignment, alignof(std::max_align_t));
+            if (result) {
+                result = align_pointer(result, alignment);
+            }
+        }
+        if (!result) {
+            throw std::bad_alloc();
+        }
+        return result;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    Arena* arena;
+    bool owns_arena;
+};
+
+/****************************************************************
+ * Pool resource over FsbArenas.
+ *
+ * Requests are rounded up to the power of two size class,
+ * each size class is served by its own FsbArena.
+ * Requests larger than the biggest class go to upstream resource.
+ *
+ * Like std::pmr::unsynchronized_pool_resource, this is not thread-safe.
+ */
+
+class FsbPoolResource : public std::pmr::memory_resource {
+public:
+    static constexpr unsigned min_block_size = 8;
+    static constexpr unsigned max_block_size = 1024;
+    static constexpr unsigned num_classes = 8;  // 8, 16, ... 1024
+
+    explicit FsbPoolResource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : upstream(upstream)
+    {
+        unsigned block_size = min_block_size;
+        for (unsigned i = 0; i < num_classes; i++, block_size <<= 1) {
+            if (!_init_fsb_arena(&arenas[i], block_size, block_size)) {
+                throw std::bad_alloc();
+            }
+        }
+    }
+
+    FsbPoolResource(const FsbPoolResource&) = delete;
+    FsbPoolResource& operator=(const FsbPoolResource&) = delete;
+
+    ~FsbPoolResource() override
+    {
+        for (unsigned i = 0; i < num_classes; i++) {
+            destroy_fsb_arena(&arenas[i]);
+        }
+    }
+
+    std::pmr::memory_resource* upstream_resource() const noexcept
+    {
+        return upstream;
+    }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        FsbArena* arena = arena_for(bytes, alignment);
+        if (!arena) {
+            return upstream->allocate(bytes, alignment);
+        }
+        void* result = fsb_arena_allocate(arena);
+        if (!result) {
+            throw std::bad_alloc();
+        }
+        return result;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        FsbArena* arena = arena_for(bytes, alignment);
+        if (arena) {
+            fsb_arena_free(arena, &p);
+        } else {
+            upstream->deallocate(p, bytes, alignment);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    std::pmr::memory_resource* upstream;
+    FsbArena arenas[num_classes];
+
+    FsbArena* arena_for(std::size_t bytes, std::size_t alignment) noexcept
+    {
+        // blocks in FsbArena are aligned at block size
+        std::size_t size = (bytes > alignment)? bytes : alignment;
+        if (size > max_block_size) {
+            return nullptr;
+        }
+        unsigned i = 0;
+        for (std::size_t block_size = min_block_size; block_size < size; block_size <<= 1) {
+            i++;
+        }
+        return &arenas[i];
+    }
+};
+
+/****************************************************************
+ * General purpose resource over Allocator.
+ *
+ * Allocators return blocks aligned at max_align_t boundary.
+ * For greater alignment the block is allocated with extra space
+ * and the original address is saved right before the aligned one.
+ */
+
+class AllocatorResource : public std::pmr::memory_resource {
+public:
+    explicit AllocatorResource(Allocator* allocator = &default_allocator)
+        : allocator(allocator)
+    {}
+
+    Allocator* get_allocator() const noexcept
+    {
+        return allocator;
+    }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        std::size_t nbytes = alloc_size(bytes, alignment);
+        if (nbytes > UINT_MAX) {
+            throw std::bad_alloc();
+        }
+        void* block = allocator->allocate(nbytes, false);
+        if (!block) {
+            throw std::bad_alloc();
+        }
+        if (alignment <= alignof(std::max_align_t)) {
+            return block;
+        }
+        void** result = (void**) align_pointer(((void**) block) + 1, alignment);
+        result[-1] = block;
+        return result;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        void* block = p;
+        if (alignment > alignof(std::max_align_t)) {
+            block = ((void**) p)[-1];
+        }
+        allocator->release(&block, alloc_size(bytes, alignment));
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        auto* other_resource = dynamic_cast<const AllocatorResource*>(&other);
+        return other_resource && other_resource->allocator->allocate == allocator->allocate;
+    }
+
+private:
+    Allocator* allocator;
+
+    static std::size_t alloc_size(std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (bytes == 0) {
+            bytes = 1;  // allocators return nullptr for zero size
+        }
+        if (alignment > alignof(std::max_align_t)) {
+            bytes += alignment;
+        }
+        return bytes;
+    }
+};
+
+}  // namespace pussy
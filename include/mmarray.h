@@ -13,6 +13,16 @@ void* mmarray_allocate(unsigned length, unsigned item_size);
  * Abort the program if mmap fails.
  */
 
+void* mmarray_allocate_with_flags(unsigned length, unsigned item_size, unsigned page_flags);
+/*
+ * Same as `mmarray_allocate` with PAGES_* options from pages.h.
+ */
+
+void* mmarray_try_allocate(unsigned length, unsigned item_size, unsigned page_flags);
+/*
+ * Same as `mmarray_allocate_with_flags` but return nullptr if mmap fails.
+ */
+
 void* mmarray_grow(void* array, unsigned increment);
 /*
  * Reallocate array if necessary using mremap.
@@ -20,6 +30,12 @@ void* mmarray_grow(void* array, unsigned increment);
  * Abort the program if mremap fails.
  */
 
+void* mmarray_try_grow(void* array, unsigned increment);
+/*
+ * Same as `mmarray_grow` but return nullptr if mremap fails.
+ * The array remains valid in this case.
+ */
+
 void* mmarray_append_item(void* array, void* item);
 /*
  * Append new item to the array.
@@ -27,8 +43,20 @@ void* mmarray_append_item(void* array, void* item);
  * Abort the program if array_grow fails.
  */
 
+void* mmarray_try_append_item(void* array, void* item);
+/*
+ * Same as `mmarray_append_item` but return nullptr if the array cannot grow.
+ * The array remains valid in this case.
+ */
+
+void mmarray_free(void* array);
+/*
+ * Unmap array.
+ */
+
 unsigned mmarray_length(void* array);
 unsigned mmarray_capacity(void* array);
+unsigned mmarray_page_flags(void* array);
 
 #ifdef __cplusplus
 }
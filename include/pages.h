@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Page mapping options for mmap-based data structures.
+ */
+
+#define PAGES_HUGE      1  // transparent huge pages: 2M-aligned mapping with madvise(MADV_HUGEPAGE)
+#define PAGES_HUGETLB   2  // explicit huge pages (MAP_HUGETLB), falls back to PAGES_HUGE
+#define PAGES_POPULATE  4  // fault pages in when mapped, not on first touch
+#define PAGES_LOCK      8  // lock pages in memory with mlock, implies PAGES_POPULATE
+
+size_t get_huge_page_size();
+/*
+ * Return huge page size, usually 2M.
+ */
+
+size_t align_to_pages(size_t size, unsigned flags);
+/*
+ * Round `size` up to huge page size for PAGES_HUGETLB
+ * or to system page size otherwise.
+ */
+
+void* map_pages(size_t size, unsigned flags, unsigned* obtained_flags);
+/*
+ * Map anonymous read/write pages.
+ *
+ * `size` must be aligned with `align_to_pages`.
+ * On success, `obtained_flags` (optional, can be nullptr) receives the options actually applied.
+ * Huge pages are not used for mappings smaller than huge page size.
+ * Failure to populate or lock pages is not an error, check `obtained_flags`.
+ *
+ * Return nullptr on error.
+ */
+
+void* map_aligned_pages(size_t size, size_t alignment, unsigned flags, unsigned* obtained_flags);
+/*
+ * Same as `map_pages` but the result is aligned at `alignment` boundary,
+ * which must be a power of two multiple of page size.
+ * PAGES_HUGETLB is treated as PAGES_HUGE.
+ */
+
+void* reserve_pages(size_t size, unsigned flags, unsigned* obtained_flags);
+/*
+ * Reserve address space without access. Use mprotect to commit pages.
+ *
+ * PAGES_HUGETLB is not supported for reservations, it is treated as PAGES_HUGE.
+ * PAGES_POPULATE and PAGES_LOCK are applied by `commit_pages`.
+ */
+
+bool commit_pages(void* addr, size_t size, unsigned flags, unsigned* obtained_flags);
+/*
+ * Give read/write access to reserved pages and apply
+ * PAGES_POPULATE and PAGES_LOCK options.
+ *
+ * If `obtained_flags` is not nullptr, PAGES_POPULATE and PAGES_LOCK
+ * are cleared there when they could not be applied.
+ */
+
+bool populate_pages(void* addr, size_t size);
+/*
+ * Fault in pages with MADV_POPULATE_WRITE.
+ * On older kernels fall back to touching each page.
+ * Pages must not be modified concurrently by other threads.
+ */
+
+void unmap_pages(void* addr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
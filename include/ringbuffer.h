@@ -16,6 +16,7 @@ typedef struct {
     unsigned size;
     unsigned head;
     unsigned tail;
+    unsigned page_flags;  // PAGES_* options obtained for the buffer
 } RingBuffer;
 
 bool init_ringbuffer(RingBuffer* ringbuf, unsigned size);
@@ -26,6 +27,14 @@ bool init_ringbuffer(RingBuffer* ringbuf, unsigned size);
  * strictly required. It will be rounded as necessary.
  */
 
+bool init_ringbuffer_with_flags(RingBuffer* ringbuf, unsigned size, unsigned page_flags);
+/*
+ * Initialize ring buffer with PAGES_* options from pages.h.
+ *
+ * With PAGES_HUGETLB the size is rounded to huge page size
+ * and the buffer grows and shrinks in huge page steps.
+ */
+
 void fini_ringbuffer(RingBuffer* ringbuf);
 /*
  * Finalize ring buffer.
@@ -1,9 +1,13 @@
+#include <threads.h>
+
 #include "allocator.h"
 
 unsigned sys_page_size = 0;
 
 Allocator default_allocator = {};
 
+thread_local unsigned allocation_tag = 0;
+
 [[ gnu::constructor ]]
 static void init_page_size()
 {
@@ -11,3 +15,130 @@ static void init_page_size()
         sys_page_size = sysconf(_SC_PAGE_SIZE);
     }
 }
+
+void dump_allocation_tags(FILE* fp, Allocator* allocator)
+{
+    AllocatorStats* stats = allocator->stats;
+    for (unsigned tag = 0; tag < NUM_ALLOCATION_TAGS; tag++) {
+        size_t blocks = stats->tags[tag].blocks_allocated;
+        size_t bytes = stats->tags[tag].bytes_allocated;
+        if (blocks || bytes) {
+            fprintf(fp, "Tag %u: %zu blocks, %zu bytes\n", tag, blocks, bytes);
+        }
+    }
+}
+
+/****************************************************************
+ * Memory budget
+ */
+
+static thread_local bool in_pressure_callbacks = false;
+
+static inline void lock_budget(AllocatorBudget* budget)
+{
+    while (atomic_flag_test_and_set_explicit(&budget->lock, memory_order_acquire)) {
+        thrd_yield();
+    }
+}
+
+static inline void unlock_budget(AllocatorBudget* budget)
+{
+    atomic_flag_clear_explicit(&budget->lock, memory_order_release);
+}
+
+static void call_pressure_callbacks(AllocatorBudget* budget, size_t bytes_in_use, bool hard_limit)
+{
+    if (in_pressure_callbacks) {
+        return;
+    }
+    // take a copy of callbacks to call them without holding the lock
+    PressureCallback callbacks[MAX_PRESSURE_CALLBACKS];
+    lock_budget(budget);
+    unsigned n = budget->num_callbacks;
+    for (unsigned i = 0; i < n; i++) {
+        callbacks[i] = budget->callbacks[i];
+    }
+    unlock_budget(budget);
+
+    in_pressure_callbacks = true;
+    for (unsigned i = 0; i < n; i++) {
+        callbacks[i].callback(callbacks[i].cb_data, bytes_in_use, hard_limit);
+    }
+    in_pressure_callbacks = false;
+}
+
+bool budget_charge(AllocatorBudget* budget, size_t nbytes)
+{
+    size_t hard_limit = budget->hard_limit;
+    size_t prev = atomic_fetch_add(&budget->bytes_in_use, nbytes);
+
+    if (hard_limit && prev + nbytes > hard_limit) {
+        // give callbacks a chance to shed memory and try again
+        atomic_fetch_sub(&budget->bytes_in_use, nbytes);
+        call_pressure_callbacks(budget, prev, true);
+
+        prev = atomic_fetch_add(&budget->bytes_in_use, nbytes);
+        if (prev + nbytes > hard_limit) {
+            atomic_fetch_sub(&budget->bytes_in_use, nbytes);
+            return false;
+        }
+    }
+
+    size_t soft_limit = budget->soft_limit;
+    if (soft_limit && prev <= soft_limit && prev + nbytes > soft_limit) {
+        call_pressure_callbacks(budget, prev + nbytes, false);
+    }
+    return true;
+}
+
+void budget_uncharge(AllocatorBudget* budget, size_t nbytes)
+{
+    atomic_fetch_sub(&budget->bytes_in_use, nbytes);
+}
+
+void set_allocator_budget(Allocator* allocator, size_t soft_limit, size_t hard_limit)
+{
+    AllocatorBudget* budget = allocator->budget;
+    if (budget) {
+        budget->soft_limit = soft_limit;
+        budget->hard_limit = hard_limit;
+    }
+}
+
+bool add_pressure_callback(Allocator* allocator, FnMemoryPressure callback, void* cb_data)
+{
+    AllocatorBudget* budget = allocator->budget;
+    if (!budget) {
+        return false;
+    }
+    bool result = false;
+    lock_budget(budget);
+    if (budget->num_callbacks < MAX_PRESSURE_CALLBACKS) {
+        budget->callbacks[budget->num_callbacks++] = (PressureCallback) {
+            .callback = callback,
+            .cb_data  = cb_data
+        };
+        result = true;
+    }
+    unlock_budget(budget);
+    return result;
+}
+
+void remove_pressure_callback(Allocator* allocator, FnMemoryPressure callback, void* cb_data)
+{
+    AllocatorBudget* budget = allocator->budget;
+    if (!budget) {
+        return;
+    }
+    lock_budget(budget);
+    for (unsigned i = 0; i < budget->num_callbacks; i++) {
+        if (budget->callbacks[i].callback == callback && budget->callbacks[i].cb_data == cb_data) {
+            budget->num_callbacks--;
+            for (; i < budget->num_callbacks; i++) {
+                budget->callbacks[i] = budget->callbacks[i + 1];
+            }
+            break;
+        }
+    }
+    unlock_budget(budget);
+}
@@ -7,6 +7,7 @@
 #include "dump.h"
 
 static AllocatorStats stats = {};
+static AllocatorBudget budget = {};
 
 #define BUBBLEWRAP  32  // the number of bytes around allocated block
 
@@ -78,6 +79,9 @@ static void* _allocate(unsigned nbytes, bool clean)
 {
     unsigned memsize = calc_memsize(nbytes);
 
+    if (!budget_charge(&budget, memsize)) {
+        return nullptr;
+    }
     uint8_t* region_start;
     if (clean) {
         region_start = calloc(1, memsize);
@@ -85,6 +89,7 @@ static void* _allocate(unsigned nbytes, bool clean)
         region_start = malloc(memsize);
     }
     if (!region_start) {
+        budget_uncharge(&budget, memsize);
         return nullptr;
     }
     uint8_t* region_end  = region_start + memsize;
@@ -104,7 +109,7 @@ static void* _allocate(unsigned nbytes, bool clean)
     info->addr = block_start;
     info->nbytes = nbytes;
 
-    atomic_fetch_add(&stats.blocks_allocated, 1);
+    stats_add_block(&stats, nbytes);
 
     if (debug_allocator.verbose) {
         printf("%s: %u bytes -> %p\n", __func__, nbytes, (void*) block_start);
@@ -126,7 +131,8 @@ static void _release(void** addr_ptr, unsigned nbytes)
     if (debug_allocator.verbose) {
         fprintf(stderr, "%s: %p %u bytes\n", __func__, addr, nbytes);
     }
-    atomic_fetch_sub(&stats.blocks_allocated, 1);
+    stats_sub_block(&stats, nbytes);
+    budget_uncharge(&budget, calc_memsize(nbytes));
 
     *addr_ptr = nullptr;
 }
@@ -180,7 +186,8 @@ error:
 
 static void _dump()
 {
-    fprintf(stderr, "Debug allocator: dump is not implemented\n");
+    fprintf(stderr, "Debug allocator: blocks allocated %zu\n", stats.blocks_allocated);
+    dump_allocation_tags(stderr, &debug_allocator);
 }
 
 Allocator debug_allocator = {
@@ -191,5 +198,6 @@ Allocator debug_allocator = {
     .dump       = _dump,
     .trace      = false,
     .verbose    = false,
-    .stats      = &stats
+    .stats      = &stats,
+    .budget     = &budget
 };
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "fsb_arena.h"
+#include "pages.h"
+
+/*
+ * Slab-style allocator.
+ *
+ * Small blocks are allocated from thread-safe fixed size block arenas,
+ * one per size class. Size classes are powers of two and midpoints
+ * between them, so internal fragmentation does not exceed one third.
+ *
+ * Blocks bigger than the largest size class are mapped directly.
+ *
+ * Budget accounts rounded block sizes for small blocks
+ * and mapped sizes for big ones.
+ */
+
+#define QUANTUM  alignof(max_align_t)
+
+static const unsigned size_classes[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+
+#define NUM_SIZE_CLASSES  (sizeof(size_classes) / sizeof(size_classes[0]))
+#define MAX_CLASS_SIZE    4096
+
+static SyncFsbArena arenas[NUM_SIZE_CLASSES];
+
+static AllocatorStats stats = {};
+
+static AllocatorBudget budget = {};
+
+static inline unsigned size_class(unsigned nbytes)
+/*
+ * Return index of the smallest size class that fits `nbytes`
+ * which must not exceed MAX_CLASS_SIZE.
+ */
+{
+    unsigned i = 0;
+    while (size_classes[i] < nbytes) {
+        i++;
+    }
+    return i;
+}
+
+static inline unsigned mapped_size(unsigned nbytes)
+{
+    return align_unsigned_to_page(nbytes);
+}
+
+static unsigned map_flags()
+/*
+ * PAGES_HUGETLB would require huge page granularity, use PAGES_HUGE instead.
+ */
+{
+    unsigned page_flags = fsb_allocator.page_flags & (PAGES_POPULATE | PAGES_LOCK);
+    if (fsb_allocator.page_flags & (PAGES_HUGE | PAGES_HUGETLB)) {
+        page_flags |= PAGES_HUGE;
+    }
+    return page_flags;
+}
+
+/*
+ * Thread magazines of size class arenas can't be allocated with fsb_allocator
+ * when it is the default one. They are taken from arenas directly, under the lock,
+ * and they are not accounted in stats and budget.
+ */
+
+static void* allocate_magazine(unsigned nbytes, bool clean)
+{
+    SyncFsbArena* sfa = &arenas[size_class(nbytes)];
+    mtx_lock(&sfa->lock);
+    void* result = fsb_arena_allocate(&sfa->arena);
+    mtx_unlock(&sfa->lock);
+    return result;
+}
+
+static void release_magazine(void** addr_ptr, unsigned nbytes)
+{
+    SyncFsbArena* sfa = &arenas[size_class(nbytes)];
+    mtx_lock(&sfa->lock);
+    fsb_arena_free(&sfa->arena, addr_ptr);
+    mtx_unlock(&sfa->lock);
+}
+
+static Allocator magazine_allocator = {
+    .allocate = allocate_magazine,
+    .release  = release_magazine
+};
+
+static void _init()
+{
+    for (unsigned i = 0; i < NUM_SIZE_CLASSES; i++) {
+        // blocks are released with known arena, multi-page slabs are fine
+        if (!_sfa_init_with_slab_size(&arenas[i], size_classes[i], QUANTUM, FSB_AUTO_SLAB_SIZE, 0)) {
+            fprintf(stderr, "%s: cannot init arena for size class %u\n", __func__, size_classes[i]);
+            abort();
+        }
+        arenas[i].magazine_allocator = &magazine_allocator;
+    }
+}
+
+static void* _allocate(unsigned nbytes, bool clean)
+{
+    if (nbytes == 0) {
+        return nullptr;
+    }
+    void* result;
+    if (nbytes <= MAX_CLASS_SIZE) {
+        unsigned i = size_class(nbytes);
+        if (!budget_charge(&budget, size_classes[i])) {
+            return nullptr;
+        }
+        result = sfa_allocate(&arenas[i]);
+        if (!result) {
+            budget_uncharge(&budget, size_classes[i]);
+            return nullptr;
+        }
+        if (clean) {
+            memset(result, 0, nbytes);
+        }
+    } else {
+        // mapped pages are already clean
+        unsigned size = mapped_size(nbytes);
+        if (!budget_charge(&budget, size)) {
+            return nullptr;
+        }
+        result = map_pages(size, map_flags(), nullptr);
+        if (!result) {
+            budget_uncharge(&budget, size);
+            return nullptr;
+        }
+    }
+    stats_add_block(&stats, nbytes);
+    return result;
+}
+
+static void _release(void** addr_ptr, unsigned nbytes)
+{
+    void* addr = *addr_ptr;
+    if (!addr) {
+        return;
+    }
+    if (nbytes == 0) {
+        fprintf(stderr, "%s: called for %p with zero nbytes\n", __func__, addr);
+        abort();
+    }
+    if (nbytes <= MAX_CLASS_SIZE) {
+        unsigned i = size_class(nbytes);
+        sfa_free(&arenas[i], addr_ptr);
+        budget_uncharge(&budget, size_classes[i]);
+    } else {
+        unsigned size = mapped_size(nbytes);
+        unmap_pages(addr, size);
+        budget_uncharge(&budget, size);
+        *addr_ptr = nullptr;
+    }
+    stats_sub_block(&stats, nbytes);
+}
+
+static inline unsigned capacity(unsigned nbytes)
+/*
+ * Return actual size of block.
+ */
+{
+    if (nbytes <= MAX_CLASS_SIZE) {
+        return size_classes[size_class(nbytes)];
+    } else {
+        return mapped_size(nbytes);
+    }
+}
+
+static bool _reallocate(void** addr_ptr, unsigned old_nbytes, unsigned new_nbytes, bool clean, bool* addr_changed)
+{
+    if (addr_changed) { *addr_changed = false; }
+
+    void* addr = *addr_ptr;
+
+    if (addr == nullptr) {
+        if (old_nbytes != 0) {
+            return false;
+        }
+        addr = _allocate(new_nbytes, clean);
+        if (!addr) {
+            return false;
+        }
+        *addr_ptr = addr;
+        if (addr_changed) { *addr_changed = true; }
+        return true;
+    }
+    if (old_nbytes == new_nbytes) {
+        return true;
+    }
+    if (new_nbytes != 0 && capacity(old_nbytes) == capacity(new_nbytes)) {
+        // same size class or same number of pages, resize in place
+        if (clean && new_nbytes > old_nbytes) {
+            memset(((uint8_t*) addr) + old_nbytes, 0, new_nbytes - old_nbytes);
+        }
+        stats_resize_block(&stats, old_nbytes, new_nbytes);
+        return true;
+    }
+    void* new_addr = _allocate(new_nbytes, false);
+    if (!new_addr) {
+        return false;
+    }
+    if (new_nbytes > old_nbytes) {
+        memcpy(new_addr, addr, old_nbytes);
+        if (clean) {
+            memset(((uint8_t*) new_addr) + old_nbytes, 0, new_nbytes - old_nbytes);
+        }
+    } else {
+        memcpy(new_addr, addr, new_nbytes);
+    }
+    _release(addr_ptr, old_nbytes);
+    *addr_ptr = new_addr;
+    if (addr_changed) { *addr_changed = true; }
+    return true;
+}
+
+static void _dump()
+{
+    fprintf(stderr, "Fsb allocator: blocks allocated %zu; bytes in use %zu\n",
+            stats.blocks_allocated, budget.bytes_in_use);
+    for (unsigned i = 0; i < NUM_SIZE_CLASSES; i++) {
+        FsbArena* arena = &arenas[i].arena;
+        if (arena->mmap_calls) {
+            fprintf(stderr, "  size %4u: slab %u bytes, %u blocks per slab; mmap calls %zu, munmap calls %zu\n",
+                    size_classes[i], arena->slab_size, arena->blocks_per_page,
+                    arena->mmap_calls, arena->munmap_calls);
+        }
+    }
+    dump_allocation_tags(stderr, &fsb_allocator);
+}
+
+Allocator fsb_allocator = {
+    .init       = _init,
+    .allocate   = _allocate,
+    .reallocate = _reallocate,
+    .release    = _release,
+    .dump       = _dump,
+    .trace      = false,
+    .verbose    = false,
+    .stats      = &stats,
+    .budget     = &budget
+};
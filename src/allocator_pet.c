@@ -13,6 +13,7 @@
 
 #include "allocator.h"
 #include "dump.h"
+#include "pages.h"
 #include "src/word.h"
 
 // unit size should not be less than size of pointer
@@ -51,8 +52,12 @@ static void print_msg(const char* func_name, char* fmt, ...)
 
 static AllocatorStats stats = {};
 
+static AllocatorBudget budget = {};  // accounts all pages obtained with mmap
+
 static atomic_size_t num_bm_pages = 0;
 
+static atomic_uint obtained_page_flags = ~0u;  // PAGES_* options applied to all mappings
+
 /****************************************************************
  * memory cleaning
  */
@@ -111,11 +116,27 @@ static void* call_mmap(unsigned size, bool clean)
  * so explicit cleaning is a must
  */
 {
-    void* result = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (result == MAP_FAILED) {
-        ERR("mmap: %s\n", strerror(errno));
+    if (!budget_charge(&budget, size)) {
+        SAY("hard limit exceeded, cannot allocate %u bytes\n", size);
+        return nullptr;
+    }
+    // explicit huge pages would require huge page aligned sizes for munmap and mremap,
+    // use transparent huge pages instead
+    unsigned page_flags = pet_allocator.page_flags & (PAGES_POPULATE | PAGES_LOCK);
+    if (pet_allocator.page_flags & (PAGES_HUGE | PAGES_HUGETLB)) {
+        page_flags |= PAGES_HUGE;
+    }
+    unsigned obtained;
+    void* result = map_pages(size, page_flags, &obtained);
+    if (!result) {
+        budget_uncharge(&budget, size);
         return nullptr;
     }
+    if (size < get_huge_page_size()) {
+        // small mappings never get huge pages, don't let them clear the flag
+        obtained |= page_flags & PAGES_HUGE;
+    }
+    atomic_fetch_and_explicit(&obtained_page_flags, obtained, memory_order_relaxed);
     if (clean) {
         cleanse(result, 0, size);
     }
@@ -126,6 +147,8 @@ static inline void call_munmap(void* addr, unsigned size)
 {
     if (munmap(addr, size) == -1) {
         ERR("munmap(%p, %u): %s\n", addr, size, strerror(errno));
+    } else {
+        budget_uncharge(&budget, size);
     }
 }
 
@@ -145,6 +168,10 @@ static void* call_mremap(void* addr, unsigned old_nbytes, unsigned new_nbytes, b
     int flags;
     if (new_size > old_size) {
         flags = MREMAP_MAYMOVE;
+        if (!budget_charge(&budget, new_size - old_size)) {
+            SAY("hard limit exceeded, cannot grow %p to %u bytes\n", addr, new_size);
+            return nullptr;
+        }
     } else {
         flags = 0;
         clean = false;  // don't clean when shrinking
@@ -154,12 +181,21 @@ static void* call_mremap(void* addr, unsigned old_nbytes, unsigned new_nbytes, b
         ERR("mremap(%p, %u, %u): %s\n", addr, old_size, new_size, strerror(errno));
         if (new_size > old_size) {
             // grow failed
+            budget_uncharge(&budget, new_size - old_size);
             return nullptr;
         } else {
             // shrink failed, return same address
             return addr;
         }
     }
+    if (new_size < old_size) {
+        budget_uncharge(&budget, old_size - new_size);
+    } else if ((pet_allocator.page_flags & (PAGES_POPULATE | PAGES_LOCK)) == PAGES_POPULATE) {
+        // locked mappings are populated by mremap
+        if (!populate_pages(((uint8_t*) new_addr) + old_size, new_size - old_size)) {
+            atomic_fetch_and_explicit(&obtained_page_flags, ~PAGES_POPULATE, memory_order_relaxed);
+        }
+    }
     if (clean) {
         cleanse(new_addr, old_nbytes, new_nbytes);
     }
@@ -240,8 +276,8 @@ static void dump_bm_page(BmPageHeader* bm_page)
 static void dump()
 {
     BmPageHeader** list = superblock;
-    fprintf(stderr, "\nAllocator bm pages: %zu, blocks allocated %zu\n",
-            num_bm_pages, stats.blocks_allocated);
+    fprintf(stderr, "\nAllocator bm pages: %zu, blocks allocated %zu, bytes in use %zu\n",
+            num_bm_pages, stats.blocks_allocated, budget.bytes_in_use);
     if (lru_page) {
         fprintf(stderr, "LRU page: %p\n", (void*) lru_page);
         dump_bm_page(lru_page);
@@ -257,6 +293,7 @@ static void dump()
             } while (bm_page != first_page);
         }
     }
+    dump_allocation_tags(stderr, &pet_allocator);
     fputc('\n', stderr);
 }
 
@@ -498,7 +535,7 @@ static void delete_from_list(BmPageHeader* bm_page)
         }
 #   endif
 
-    if (bm_page->next == bm_page->prev) {
+    if (bm_page->next == bm_page) {
         // last page, make list empty
         *list = nullptr;
     } else {
@@ -726,10 +763,6 @@ static void* bm_allocate(unsigned num_units, bool clean)
     result = ((uint8_t*) bm_page) + bm_page_header_size_in_units * UNIT_SIZE;
 
 out:
-    if (result) {
-        atomic_fetch_add(&stats.blocks_allocated, 1);
-    }
-
     if (result && clean) {
         cleanse(result, 0, num_units * UNIT_SIZE);
     }
@@ -786,7 +819,11 @@ static void bm_release(BmPageHeader* bm_page, unsigned offset, unsigned num_unit
     clear_bits(bm_page, offset, num_units);
 
     unhand_page(bm_page);
-    atomic_fetch_sub(&stats.blocks_allocated, 1);
+}
+
+unsigned pet_allocator_page_flags()
+{
+    return atomic_load_explicit(&obtained_page_flags, memory_order_relaxed);
 }
 
 /****************************************************************
@@ -831,18 +868,19 @@ static void* _allocate(unsigned nbytes, bool clean)
     if (nbytes == 0) {
         return nullptr;
     }
+    void* result;
     unsigned num_units = bytes_to_units(nbytes);
     if (num_units < max_data_units) {
         // use bitmap sub-allocator for smaller blocks
-        return bm_allocate(num_units, clean);
+        result = bm_allocate(num_units, clean);
     } else {
         // allocate pages directly
-        void* result = call_mmap(align_unsigned_to_page(nbytes), clean);
-        if (result) {
-            atomic_fetch_add(&stats.blocks_allocated, 1);
-        }
-        return result;
+        result = call_mmap(align_unsigned_to_page(nbytes), clean);
     }
+    if (result) {
+        stats_add_block(&stats, nbytes);
+    }
+    return result;
 }
 
 static void _release(void** addr_ptr, unsigned nbytes)
@@ -866,12 +904,12 @@ static void _release(void** addr_ptr, unsigned nbytes)
          * the block was allocated directly with mmap
          */
         call_munmap(addr, align_unsigned_to_page(nbytes));
-        atomic_fetch_sub(&stats.blocks_allocated, 1);
 
     } else {
         // use bitmap sub-allocator for smaller blocks
         bm_release(bm_page, ptrdiff_to_units(addr, bm_page), bytes_to_units(nbytes));
     }
+    stats_sub_block(&stats, nbytes);
     *addr_ptr = nullptr;
 }
 
@@ -912,7 +950,7 @@ static bool _reallocate(void** addr_ptr, unsigned old_nbytes, unsigned new_nbyte
         if (clean && new_nbytes > old_nbytes) {
             cleanse(addr, old_nbytes, new_nbytes);
         }
-        goto success_same_addr;
+        goto resized_same_addr;
     }
 
     BmPageHeader* bm_page = bm_page_by_addr(addr);
@@ -931,7 +969,7 @@ static bool _reallocate(void** addr_ptr, unsigned old_nbytes, unsigned new_nbyte
                     abort();
                 }
                 bm_shrink(bm_page, ptrdiff_to_units(addr, bm_page), old_num_units, new_num_units);
-                goto success_same_addr;
+                goto resized_same_addr;
             }
 
             // shrinking block from page allocator to bitmap sub-allocator
@@ -946,9 +984,9 @@ static bool _reallocate(void** addr_ptr, unsigned old_nbytes, unsigned new_nbyte
                 goto remap;
             }
             memcpy(new_block, addr, new_nbytes);
-            bm_release(bm_page, ptrdiff_to_units(addr, bm_page), new_num_units);
+            call_munmap(addr, align_unsigned_to_page(old_nbytes));
             *addr_ptr = new_block;
-            goto success_changed_addr;
+            goto resized_changed_addr;
 
         } else {
             // shrink using mremap
@@ -958,7 +996,7 @@ static bool _reallocate(void** addr_ptr, unsigned old_nbytes, unsigned new_nbyte
             }
     remap:
             call_mremap(addr, old_nbytes, new_nbytes, false);
-            goto success_same_addr;
+            goto resized_same_addr;
         }
     }
 
@@ -979,7 +1017,7 @@ static bool _reallocate(void** addr_ptr, unsigned old_nbytes, unsigned new_nbyte
                 if (clean) {
                     cleanse(addr, old_nbytes, new_nbytes);
                 }
-                goto success_same_addr;
+                goto resized_same_addr;
             }
         }
 
@@ -1009,14 +1047,21 @@ static bool _reallocate(void** addr_ptr, unsigned old_nbytes, unsigned new_nbyte
             goto error;
         }
         *addr_ptr = new_addr;
+        stats_resize_block(&stats, old_nbytes, new_nbytes);
         if (addr_changed) { *addr_changed = new_addr != addr; }
         return true;
     }
 
+resized_changed_addr:
+    stats_resize_block(&stats, old_nbytes, new_nbytes);
+
 success_changed_addr:
     if (addr_changed) { *addr_changed = true; }
     return true;
 
+resized_same_addr:
+    stats_resize_block(&stats, old_nbytes, new_nbytes);
+
 success_same_addr:
     if (addr_changed) { *addr_changed = false; }
     return true;
@@ -1034,5 +1079,7 @@ Allocator pet_allocator = {
     .dump       = dump,
     .trace      = false,
     .verbose    = false,
-    .stats      = &stats
+    .page_flags = 0,
+    .stats      = &stats,
+    .budget     = &budget
 };
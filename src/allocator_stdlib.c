@@ -5,9 +5,13 @@
 #include "allocator.h"
 
 static AllocatorStats stats = {};
+static AllocatorBudget budget = {};
 
 static void* _allocate(unsigned nbytes, bool clean)
 {
+    if (!budget_charge(&budget, nbytes)) {
+        return nullptr;
+    }
     void* result;
     if (clean) {
         result = calloc(1, nbytes);
@@ -15,7 +19,9 @@ static void* _allocate(unsigned nbytes, bool clean)
         result = malloc(nbytes);
     }
     if (result) {
-        atomic_fetch_add(&stats.blocks_allocated, 1);
+        stats_add_block(&stats, nbytes);
+    } else {
+        budget_uncharge(&budget, nbytes);
     }
     return result;
 }
@@ -26,7 +32,8 @@ static void _release(void** addr_ptr, unsigned nbytes)
     if (addr) {
         free(addr);
         *addr_ptr = nullptr;
-        atomic_fetch_sub(&stats.blocks_allocated, 1);
+        stats_sub_block(&stats, nbytes);
+        budget_uncharge(&budget, nbytes);
     }
 }
 
@@ -51,11 +58,21 @@ static bool _reallocate(void** addr_ptr, unsigned old_nbytes, unsigned new_nbyte
         goto success_changed_addr;
     }
 
+    if (new_nbytes > old_nbytes && !budget_charge(&budget, new_nbytes - old_nbytes)) {
+        goto error;
+    }
     void* new_block = realloc(addr, new_nbytes);
     if (!new_block) {
+        if (new_nbytes > old_nbytes) {
+            budget_uncharge(&budget, new_nbytes - old_nbytes);
+        }
         goto error;
     }
+    if (new_nbytes < old_nbytes) {
+        budget_uncharge(&budget, old_nbytes - new_nbytes);
+    }
     *addr_ptr = new_block;
+    stats_resize_block(&stats, old_nbytes, new_nbytes);
     if (addr_changed) { *addr_changed = new_block != addr; }
     if (clean && old_nbytes < new_nbytes) {
         memset(((uint8_t*) new_block) + old_nbytes, 0, new_nbytes - old_nbytes);
@@ -77,7 +94,8 @@ error:
 
 static void _dump()
 {
-    fprintf(stderr, "Stdlib allocator: dump is not implemented\n");
+    fprintf(stderr, "Stdlib allocator: blocks allocated %zu\n", stats.blocks_allocated);
+    dump_allocation_tags(stderr, &stdlib_allocator);
 }
 
 Allocator stdlib_allocator = {
@@ -88,5 +106,6 @@ Allocator stdlib_allocator = {
     .dump       = _dump,
     .trace      = false,
     .verbose    = false,
-    .stats      = &stats
+    .stats      = &stats,
+    .budget     = &budget
 };
@@ -1,9 +1,18 @@
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "arena.h"
 #include "allocator.h"
+#include "pages.h"
 
 [[ gnu::constructor ]]
 static void init_page_size()
@@ -22,19 +31,14 @@ static void init_page_size()
 
 #define max(a, b) (((a) > (b))? (a) : (b))
 
-static void* alloc_mem(unsigned size)
+static inline size_t align_size(size_t n, unsigned alignment)
 {
-    void* result = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (result == MAP_FAILED) {
-        perror("Arena allocation");
-        return nullptr;
-    }
-    return result;
+    return (n + alignment - 1) & ~((size_t) alignment - 1);
 }
 
-static inline void free_mem(void* ptr, unsigned size)
+static inline void free_mem(void* ptr, size_t size)
 {
-    munmap(ptr, size);
+    unmap_pages(ptr, size);
 }
 
 /**********************************************************
@@ -45,19 +49,57 @@ typedef struct _Region Region;
 
 struct _Region {
     Region* next;
-    unsigned tail;
-    unsigned capacity;
-    char data[1];
+    size_t tail;
+    size_t capacity;
+    Region* fit_next;  // free space index list
+    Region* fit_prev;
+    int fit_bucket;    // -1 if the region is not in the index
+    alignas(max_align_t) char data[1];
 };
 
 #define REGION_HEADER_SIZE offsetof(Region, data)
 
+static_assert(REGION_HEADER_SIZE % alignof(max_align_t) == 0, "region data must be aligned for any type");
+
+#define FIT_BUCKETS     64
+#define MIN_FIT_BUCKET  4
+#define MIN_FIT_SPACE   (1 << MIN_FIT_BUCKET)  // regions with less free space are not indexed
+
 struct _Arena {
     Region* last;
     unsigned new_region_capacity;
+    ArenaGrowthPolicy growth_policy;
+    unsigned max_region_capacity;   // growth limit
+    unsigned prev_region_capacity;  // for fibonacci growth
+    unsigned page_flags;           // requested PAGES_* options
+    unsigned obtained_page_flags;  // options applied to all regions
+
+    // cumulative statistics
+    size_t total_requested;
+    size_t total_alignment_waste;
+    size_t num_allocations;
+    size_t high_water_mark;  // updated when bytes are given back and when stats are taken
+    size_t bytes_used;       // sum of region tails
+    size_t mmap_calls;
+    size_t committed;  // contiguous arena only: number of bytes with read/write access
+                       // from the beginning of arena; zero for regular arenas
+
+    // free space index: regions grouped by floor(log2(free space))
+    uint64_t fit_mask;  // bit is set if bucket is not empty
+    Region* fit_buckets[FIT_BUCKETS];
+
     Region  first;  // arena embeds the first region
 };
 
+/*
+ * Contiguous arena reserves address space for the first region
+ * with PROT_NONE and gives access to pages as the tail advances.
+ */
+
+#define CONTIGUOUS_COMMIT_SIZE  65536  // granularity of committing pages, must be a multiple of page size
+
+#define is_contiguous(arena)  ((arena)->committed != 0)
+
 #define ARENA_HEADER_SIZE (offsetof(Arena, first) + REGION_HEADER_SIZE)
 
 
@@ -75,18 +117,107 @@ static inline void free_region(Region* region)
     free_mem(region, region->capacity + REGION_HEADER_SIZE);
 }
 
-static Region* create_region(unsigned capacity)
+static void grow_region_capacity(Arena* arena)
+/*
+ * Calculate capacity of the next region according to growth policy.
+ */
 {
-    unsigned mem_size = align_unsigned_to_page(capacity + REGION_HEADER_SIZE);
-    Region* region = alloc_mem(mem_size);
+    size_t capacity = arena->new_region_capacity;
+    switch (arena->growth_policy) {
+        case ARENA_GROWTH_FIXED:
+            return;
+        case ARENA_GROWTH_DOUBLING:
+            capacity *= 2;
+            break;
+        case ARENA_GROWTH_FIBONACCI:
+            capacity += arena->prev_region_capacity;
+            break;
+    }
+    if (capacity > arena->max_region_capacity) {
+        capacity = arena->max_region_capacity;
+    }
+    arena->prev_region_capacity = arena->new_region_capacity;
+    arena->new_region_capacity = capacity;
+}
+
+static Region* create_region(Arena* arena, unsigned capacity)
+{
+    size_t mem_size = align_to_pages(((size_t) capacity) + REGION_HEADER_SIZE, arena->page_flags);
+    unsigned obtained_flags;
+    Region* region = map_pages(mem_size, arena->page_flags, &obtained_flags);
+    arena->mmap_calls++;
     if (region) {
+        arena->obtained_page_flags &= obtained_flags;
         region->next = nullptr;
         region->tail = 0;
         region->capacity = mem_size - REGION_HEADER_SIZE;
+        region->fit_bucket = -1;
     }
     return region;
 }
 
+/*
+ * Free space index.
+ *
+ * Any region in bucket N has at least 2^N bytes available,
+ * so the lowest non-empty bucket above the requested size
+ * always gives a fitting region.
+ */
+
+static inline int fit_bucket(Region* region)
+{
+    size_t free_space = region->capacity - region->tail;
+    if (free_space < MIN_FIT_SPACE) {
+        return -1;
+    }
+    return 63 - __builtin_clzll(free_space);
+}
+
+static void unindex_region(Arena* arena, Region* region)
+{
+    int bucket = region->fit_bucket;
+    if (bucket < 0) {
+        return;
+    }
+    if (region->fit_prev) {
+        region->fit_prev->fit_next = region->fit_next;
+    } else {
+        arena->fit_buckets[bucket] = region->fit_next;
+        if (!region->fit_next) {
+            arena->fit_mask &= ~(((uint64_t) 1) << bucket);
+        }
+    }
+    if (region->fit_next) {
+        region->fit_next->fit_prev = region->fit_prev;
+    }
+    region->fit_bucket = -1;
+}
+
+static void index_region(Arena* arena, Region* region)
+/*
+ * Put region to the bucket that matches its free space.
+ * Must be called whenever region tail changes.
+ */
+{
+    int bucket = fit_bucket(region);
+    if (bucket == region->fit_bucket) {
+        return;
+    }
+    unindex_region(arena, region);
+    if (bucket < 0) {
+        return;
+    }
+    Region* head = arena->fit_buckets[bucket];
+    region->fit_prev = nullptr;
+    region->fit_next = head;
+    if (head) {
+        head->fit_prev = region;
+    }
+    arena->fit_buckets[bucket] = region;
+    arena->fit_mask |= ((uint64_t) 1) << bucket;
+    region->fit_bucket = bucket;
+}
+
 static void* region_alloc(Region* region, unsigned size, unsigned alignment)
 /*
  * Allocate aligned `size` bytes from `region`.
@@ -96,33 +227,152 @@ static void* region_alloc(Region* region, unsigned size, unsigned alignment)
     assert(size > 0);
     assert(alignment <= alignof(max_align_t) && is_power_of_two(alignment));
 
-    unsigned start = align_unsigned(region->tail + offsetof(Region, data), alignment) - offsetof(Region, data);
+    // align the actual address, not the offset, because region header
+    // may be embedded in the arena structure at any offset
+    size_t start = align_size((uintptr_t) &region->data[region->tail], alignment) - (uintptr_t) region->data;
     if (start >= region->capacity) {
         return nullptr;
     }
 
-    unsigned bytes_available = region->capacity - start;
+    size_t bytes_available = region->capacity - start;
     if (size > bytes_available) {
         return nullptr;
     }
 
     void* result = &region->data[start];
+    assert(((uintptr_t) result & (alignment - 1)) == 0);
     region->tail = start + size;
     return result;
 }
 
+static inline void set_region_tail(Arena* arena, Region* region, size_t tail)
+{
+    arena->bytes_used = arena->bytes_used - region->tail + tail;
+    region->tail = tail;
+    if (!is_contiguous(arena)) {
+        index_region(arena, region);
+    }
+}
+
+static inline void count_alloc(Arena* arena, Region* region, size_t old_tail, unsigned size)
+{
+    arena->num_allocations++;
+    arena->total_requested += size;
+    arena->total_alignment_waste += region->tail - old_tail - size;
+    arena->bytes_used += region->tail - old_tail;
+}
+
+static void* indexed_region_alloc(Arena* arena, Region* region, unsigned size, unsigned alignment)
+/*
+ * Call region_alloc and update free space index.
+ */
+{
+    size_t tail = region->tail;
+    void* result = region_alloc(region, size, alignment);
+    if (result) {
+        count_alloc(arena, region, tail, size);
+        index_region(arena, region);
+    }
+    return result;
+}
+
+static inline void update_high_water_mark(Arena* arena)
+{
+    if (arena->bytes_used > arena->high_water_mark) {
+        arena->high_water_mark = arena->bytes_used;
+    }
+}
+
 static void* new_region_alloc(Arena* arena, unsigned size, unsigned alignment)
 /*
- * Create new region and allocate aligned `size` bytes from it.
+ * Allocate aligned `size` bytes from the next region.
+ * Regions that follow the last one are empty regions retained by `arena_rewind`,
+ * reuse them first. Create new region if none of them fits.
+ *
+ * Retained regions are not in the free space index until the last one
+ * advances to them, otherwise `_arena_fit` could place blocks there
+ * and the next rewind would drop them.
  */
 {
-    Region* new_region = create_region(max(size, arena->new_region_capacity));
+    for (Region* region = arena->last->next; region != nullptr; region = region->next) {
+        arena->last = region;
+        void* result = indexed_region_alloc(arena, region, size, alignment);
+        if (result) {
+            return result;
+        }
+        index_region(arena, region);
+    }
+    Region* new_region = create_region(arena, max(size, arena->new_region_capacity));
     if (!new_region) {
         return nullptr;
     }
+    grow_region_capacity(arena);
     arena->last->next = new_region;
     arena->last = new_region;
-    return region_alloc(new_region, size, alignment);
+    return indexed_region_alloc(arena, new_region, size, alignment);
+}
+
+static void discard_region_data(Region* region, size_t tail)
+/*
+ * Give pages of `region` beyond `tail` back to the operating system
+ * while keeping them mapped.
+ */
+{
+    uint8_t* start = align_pointer_to_page(&region->data[tail]);
+    uint8_t* end = ((uint8_t*) region) + REGION_HEADER_SIZE + region->capacity;
+    if (start < end) {
+        madvise(start, end - start, MADV_DONTNEED);
+    }
+}
+
+static bool commit(Arena* arena, size_t size)
+/*
+ * Make sure first `size` bytes of contiguous arena are accessible.
+ */
+{
+    if (size <= arena->committed) {
+        return true;
+    }
+    size_t mem_size = arena->first.capacity + ARENA_HEADER_SIZE;
+    size_t granularity = CONTIGUOUS_COMMIT_SIZE;
+    if (arena->obtained_page_flags & PAGES_HUGE) {
+        // commit whole huge pages, otherwise they cannot be used
+        granularity = get_huge_page_size();
+    }
+    size_t new_committed = align_size(size, granularity);
+    if (new_committed > mem_size) {
+        new_committed = mem_size;
+    }
+    uint8_t* start = ((uint8_t*) arena) + arena->committed;
+    if (!commit_pages(start, new_committed - arena->committed, arena->page_flags, &arena->obtained_page_flags)) {
+        return false;
+    }
+    arena->committed = new_committed;
+    return true;
+}
+
+static void* contiguous_alloc(Arena* arena, unsigned size, unsigned alignment)
+{
+    size_t tail = arena->first.tail;
+    void* result = region_alloc(&arena->first, size, alignment);
+    if (result) {
+        if (!commit(arena, ARENA_HEADER_SIZE + arena->first.tail)) {
+            arena->first.tail = tail;
+            return nullptr;
+        }
+        count_alloc(arena, &arena->first, tail, size);
+    }
+    return result;
+}
+
+static void init_stats(Arena* arena)
+{
+    arena->total_requested = 0;
+    arena->total_alignment_waste = 0;
+    arena->num_allocations = 0;
+    arena->high_water_mark = 0;
+    arena->bytes_used = 0;
+    arena->mmap_calls = 1;
 }
 
 /**********************************************************
@@ -131,19 +381,75 @@ static void* new_region_alloc(Arena* arena, unsigned size, unsigned alignment)
 
 Arena* create_arena(unsigned capacity)
 {
-    unsigned mem_size = align_unsigned_to_page(capacity + ARENA_HEADER_SIZE);
-    Arena* arena = (Arena*) alloc_mem(mem_size);
+    return create_arena_with_flags(capacity, 0);
+}
+
+Arena* create_arena_with_flags(unsigned capacity, unsigned page_flags)
+{
+    size_t mem_size = align_to_pages(((size_t) capacity) + ARENA_HEADER_SIZE, page_flags);
+    unsigned obtained_flags;
+    Arena* arena = (Arena*) map_pages(mem_size, page_flags, &obtained_flags);
     if (arena) {
         arena->last = &arena->first;
+        arena->page_flags = page_flags;
+        arena->obtained_page_flags = obtained_flags;
+        init_stats(arena);
 
         arena->first.next = nullptr;
         arena->first.tail = 0;
         arena->first.capacity = mem_size - ARENA_HEADER_SIZE;
         arena->new_region_capacity = capacity;
+        arena->growth_policy = ARENA_GROWTH_FIXED;
+        arena->max_region_capacity = capacity;
+        arena->prev_region_capacity = capacity;
+        arena->committed = 0;
+
+        arena->fit_mask = 0;
+        for (unsigned i = 0; i < FIT_BUCKETS; i++) {
+            arena->fit_buckets[i] = nullptr;
+        }
+        arena->first.fit_bucket = -1;
+        index_region(arena, &arena->first);
     }
     return arena;
 }
 
+Arena* create_contiguous_arena(size_t reserve_size, unsigned page_flags)
+{
+    size_t mem_size = align_size(reserve_size + ARENA_HEADER_SIZE, sys_page_size);
+    unsigned obtained_flags;
+    void* mem = reserve_pages(mem_size, page_flags, &obtained_flags);
+    if (!mem) {
+        return nullptr;
+    }
+    size_t commit_size = (obtained_flags & PAGES_HUGE)? get_huge_page_size() : CONTIGUOUS_COMMIT_SIZE;
+    if (commit_size > mem_size) {
+        commit_size = mem_size;
+    }
+    // populate and lock options are applied on commit
+    obtained_flags |= page_flags & (PAGES_POPULATE | PAGES_LOCK);
+    if (!commit_pages(mem, commit_size, page_flags, &obtained_flags)) {
+        free_mem(mem, mem_size);
+        return nullptr;
+    }
+    Arena* arena = mem;
+    arena->last = &arena->first;
+    arena->new_region_capacity = 0;
+    arena->growth_policy = ARENA_GROWTH_FIXED;
+    arena->max_region_capacity = 0;
+    arena->prev_region_capacity = 0;
+    arena->page_flags = page_flags;
+    arena->obtained_page_flags = obtained_flags;
+    init_stats(arena);
+    arena->committed = commit_size;
+    arena->fit_mask = 0;  // free space index is not used
+
+    arena->first.next = nullptr;
+    arena->first.tail = 0;
+    arena->first.capacity = mem_size - ARENA_HEADER_SIZE;
+    return arena;
+}
+
 void delete_arena(Arena* arena)
 {
     for (Region* region = arena->first.next; region != nullptr;) {
@@ -163,11 +469,29 @@ void delete_arena(Arena* arena)
 void set_region_capacity(Arena* arena, unsigned capacity)
 {
     arena->new_region_capacity = capacity;
+    arena->prev_region_capacity = capacity;
+    if (arena->max_region_capacity < capacity) {
+        arena->max_region_capacity = capacity;
+    }
+}
+
+void set_region_growth(Arena* arena, ArenaGrowthPolicy policy, unsigned max_capacity)
+{
+    arena->growth_policy = policy;
+    arena->max_region_capacity = (max_capacity < arena->new_region_capacity)? arena->new_region_capacity : max_capacity;
+}
+
+unsigned arena_page_flags(Arena* arena)
+{
+    return arena->obtained_page_flags;
 }
 
 void* _arena_alloc(Arena* arena, unsigned size, unsigned alignment)
 {
-    void* result = region_alloc(arena->last, size, alignment);
+    if (is_contiguous(arena)) {
+        return contiguous_alloc(arena, size, alignment);
+    }
+    void* result = indexed_region_alloc(arena, arena->last, size, alignment);
     if (result) {
         return result;
     } else {
@@ -177,27 +501,408 @@ void* _arena_alloc(Arena* arena, unsigned size, unsigned alignment)
 
 void* _arena_fit(Arena* arena, unsigned size, unsigned alignment)
 {
-    for (Region* region = &arena->first; region != nullptr; region = region->next) {
-        void* result = region_alloc(region, size, alignment);
-        if (result) {
-            return result;
+    if (is_contiguous(arena)) {
+        return contiguous_alloc(arena, size, alignment);
+    }
+    // worst case of required space, taking alignment into account
+    size_t required = ((size_t) size) + alignment - 1;
+    int bucket = MIN_FIT_BUCKET;
+    if (required > MIN_FIT_SPACE) {
+        bucket = 64 - __builtin_clzll(required - 1);  // ceil(log2(required))
+    }
+
+    // the head of the preceding bucket may fit too, give it a try for better packing
+    if (bucket > MIN_FIT_BUCKET) {
+        Region* region = arena->fit_buckets[bucket - 1];
+        if (region) {
+            void* result = indexed_region_alloc(arena, region, size, alignment);
+            if (result) {
+                return result;
+            }
+        }
+    }
+    if (bucket < FIT_BUCKETS) {
+        uint64_t mask = arena->fit_mask & ~((((uint64_t) 1) << bucket) - 1);
+        if (mask) {
+            Region* region = arena->fit_buckets[__builtin_ctzll(mask)];
+            return indexed_region_alloc(arena, region, size, alignment);
         }
     }
     return new_region_alloc(arena, size, alignment);
 }
 
+bool arena_extend(Arena* arena, void* block, unsigned old_size, unsigned new_size)
+{
+    Region* region = arena->last;
+    uint8_t* block_end = ((uint8_t*) block) + old_size;
+    if (block_end != (uint8_t*) &region->data[region->tail]) {
+        // not the most recent allocation
+        return false;
+    }
+    size_t start = region->tail - old_size;
+    if (new_size > region->capacity - start) {
+        return false;
+    }
+    if (is_contiguous(arena) && !commit(arena, ARENA_HEADER_SIZE + start + new_size)) {
+        return false;
+    }
+    if (new_size > old_size) {
+        arena->total_requested += new_size - old_size;
+    } else {
+        update_high_water_mark(arena);
+    }
+    set_region_tail(arena, region, start + new_size);
+    return true;
+}
+
+void* arena_resize(Arena* arena, void* block, unsigned old_size, unsigned new_size, unsigned alignment)
+{
+    if (block == nullptr) {
+        return _arena_alloc(arena, new_size, alignment);
+    }
+    if (arena_extend(arena, block, old_size, new_size)) {
+        return block;
+    }
+    if (new_size <= old_size) {
+        // not the most recent allocation, shrink is no-op
+        return block;
+    }
+    void* new_block = _arena_alloc(arena, new_size, alignment);
+    if (new_block) {
+        memcpy(new_block, block, old_size);
+    }
+    return new_block;
+}
+
+/**********************************************************
+ * Arena vector
+ */
+
+void _init_arena_vector(ArenaVector* vector, Arena* arena, unsigned element_size, unsigned alignment)
+{
+    vector->arena = arena;
+    vector->data = nullptr;
+    vector->length = 0;
+    vector->capacity = 0;
+    vector->element_size = element_size;
+    vector->alignment = alignment;
+}
+
+bool arena_vector_reserve(ArenaVector* vector, unsigned capacity)
+{
+    if (capacity <= vector->capacity) {
+        return true;
+    }
+    unsigned element_size = vector->element_size;
+    void* data = arena_resize(vector->arena, vector->data,
+                              vector->capacity * element_size, capacity * element_size, vector->alignment);
+    if (!data) {
+        return false;
+    }
+    vector->data = data;
+    vector->capacity = capacity;
+    return true;
+}
+
+void* arena_vector_append(ArenaVector* vector, unsigned num_elements)
+{
+    unsigned length = vector->length + num_elements;
+    if (length > vector->capacity) {
+        // try to grow exactly as needed if the vector is the most recent allocation
+        unsigned element_size = vector->element_size;
+        if (vector->data && arena_extend(vector->arena, vector->data,
+                                         vector->capacity * element_size, length * element_size)) {
+            vector->capacity = length;
+        } else {
+            unsigned capacity = max(length, vector->capacity * 2);
+            if (!arena_vector_reserve(vector, max(capacity, ARENA_VECTOR_MIN_CAPACITY))) {
+                return nullptr;
+            }
+        }
+    }
+    void* result = ((uint8_t*) vector->data) + vector->length * vector->element_size;
+    vector->length = length;
+    return result;
+}
+
+bool arena_vector_append_data(ArenaVector* vector, void* data, unsigned num_elements)
+{
+    void* dest = arena_vector_append(vector, num_elements);
+    if (!dest) {
+        return false;
+    }
+    memcpy(dest, data, num_elements * vector->element_size);
+    return true;
+}
+
+void arena_vector_shrink_to_fit(ArenaVector* vector)
+{
+    if (vector->data && arena_extend(vector->arena, vector->data,
+                                     vector->capacity * vector->element_size,
+                                     vector->length * vector->element_size)) {
+        vector->capacity = vector->length;
+    }
+}
+
+/**********************************************************
+ * Checkpoints
+ */
+
+ArenaMark arena_mark(Arena* arena)
+{
+    return (ArenaMark) {
+        .region = arena->last,
+        .tail   = arena->last->tail
+    };
+}
+
+void arena_rewind(Arena* arena, ArenaMark mark, ArenaRewindMode mode)
+{
+    Region* region = mark.region;
+
+    assert(mark.tail <= region->tail);
+
+    update_high_water_mark(arena);
+
+    set_region_tail(arena, region, mark.tail);
+    arena->last = region;
+    if (mode == ARENA_DISCARD_REGIONS) {
+        discard_region_data(region, region->tail);
+    }
+
+    if (mode == ARENA_FREE_REGIONS) {
+        Region* next_region = region->next;
+        region->next = nullptr;
+        for (region = next_region; region != nullptr; region = next_region) {
+            next_region = region->next;
+            arena->bytes_used -= region->tail;
+            unindex_region(arena, region);
+            free_region(region);
+        }
+    } else {
+        for (region = region->next; region != nullptr; region = region->next) {
+            arena->bytes_used -= region->tail;
+            region->tail = 0;
+            unindex_region(arena, region);
+            if (mode == ARENA_DISCARD_REGIONS) {
+                discard_region_data(region, 0);
+            }
+        }
+    }
+}
+
+void arena_reset(Arena* arena, size_t max_retained_bytes)
+{
+    update_high_water_mark(arena);
+
+    size_t retained = 0;
+    for (Region* region = &arena->first; region != nullptr; region = region->next) {
+        // the limit is applied by position, not by tail: a region rewound
+        // to zero may still hold dirty pages
+        if (max_retained_bytes && retained + region->capacity > max_retained_bytes) {
+            discard_region_data(region, (retained < max_retained_bytes)? max_retained_bytes - retained : 0);
+        }
+        retained += region->capacity;
+        region->tail = 0;
+        if (region != &arena->first) {
+            unindex_region(arena, region);
+        }
+    }
+    set_region_tail(arena, &arena->first, 0);
+    arena->bytes_used = 0;
+    arena->last = &arena->first;
+}
+
+ArenaStats arena_stats(Arena* arena)
+{
+    update_high_water_mark(arena);
+
+    ArenaStats stats = {
+        .total_requested       = arena->total_requested,
+        .total_alignment_waste = arena->total_alignment_waste,
+        .num_allocations       = arena->num_allocations,
+        .high_water_mark       = arena->high_water_mark,
+        .mmap_calls            = arena->mmap_calls
+    };
+    bool before_last = true;
+    for (Region* region = &arena->first; region != nullptr; region = region->next) {
+        stats.bytes_used += region->tail;
+        stats.capacity += region->capacity;
+        stats.num_regions++;
+        if (region == arena->last) {
+            before_last = false;
+        } else if (before_last) {
+            stats.tail_waste += region->capacity - region->tail;
+        }
+    }
+    assert(stats.bytes_used == arena->bytes_used);
+    return stats;
+}
+
+/**********************************************************
+ * Snapshots
+ */
+
+static bool sync_parent_dir(const char* path)
+/*
+ * Flush directory entry of renamed file.
+ */
+{
+    char dir_path[PATH_MAX];
+    const char* slash = strrchr(path, '/');
+    if (slash == nullptr) {
+        strcpy(dir_path, ".");
+    } else if (slash == path) {
+        strcpy(dir_path, "/");
+    } else {
+        // path length is already checked by the caller
+        memcpy(dir_path, path, slash - path);
+        dir_path[slash - path] = 0;
+    }
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        fprintf(stderr, "%s open(%s): %s\n", __func__, dir_path, strerror(errno));
+        return false;
+    }
+    bool result = true;
+    if (fsync(fd) == -1) {
+        fprintf(stderr, "%s fsync(%s): %s\n", __func__, dir_path, strerror(errno));
+        result = false;
+    }
+    close(fd);
+    return result;
+}
+
+bool arena_save(Arena* arena, const char* path)
+/*
+ * Write to temporary file and rename it over `path`: the arena may be
+ * a copy-on-write mapping of that very file, truncating it in place
+ * would leave unmodified pages without backing store.
+ */
+{
+    if (!is_contiguous(arena)) {
+        fprintf(stderr, "%s: only contiguous arenas can be saved\n", __func__);
+        return false;
+    }
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int) sizeof(tmp_path)) {
+        fprintf(stderr, "%s: path is too long: %s\n", __func__, path);
+        return false;
+    }
+    int fd = mkstemp(tmp_path);
+    if (fd == -1) {
+        fprintf(stderr, "%s mkstemp(%s): %s\n", __func__, tmp_path, strerror(errno));
+        return false;
+    }
+    if (fchmod(fd, 0644) == -1) {
+        fprintf(stderr, "%s fchmod(%s): %s\n", __func__, tmp_path, strerror(errno));
+        close(fd);
+        goto error;
+    }
+
+    // committed range is page-aligned and always covers the tail
+    size_t size = align_size(ARENA_HEADER_SIZE + arena->first.tail, sys_page_size);
+    uint8_t* data = (uint8_t*) arena;
+    while (size) {
+        ssize_t n = write(fd, data, size);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "%s write(%s): %s\n", __func__, tmp_path, strerror(errno));
+            close(fd);
+            goto error;
+        }
+        data += n;
+        size -= n;
+    }
+    // data must reach the disk before rename, otherwise a crash could
+    // leave an empty or truncated file in place of the original one
+    if (fsync(fd) == -1) {
+        fprintf(stderr, "%s fsync(%s): %s\n", __func__, tmp_path, strerror(errno));
+        close(fd);
+        goto error;
+    }
+    if (close(fd) == -1) {
+        fprintf(stderr, "%s close(%s): %s\n", __func__, tmp_path, strerror(errno));
+        goto error;
+    }
+    if (rename(tmp_path, path) == -1) {
+        fprintf(stderr, "%s rename(%s, %s): %s\n", __func__, tmp_path, path, strerror(errno));
+        goto error;
+    }
+    // the file is already in place, failure only means rename may not be durable yet
+    return sync_parent_dir(path);
+
+error:
+    unlink(tmp_path);
+    return false;
+}
+
+Arena* arena_open(const char* path, bool writable)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "%s open(%s): %s\n", __func__, path, strerror(errno));
+        return nullptr;
+    }
+    struct stat st;
+    Arena header;
+    if (fstat(fd, &st) == -1 || pread(fd, &header, sizeof(Arena), 0) != sizeof(Arena)) {
+        fprintf(stderr, "%s: cannot read %s\n", __func__, path);
+        close(fd);
+        return nullptr;
+    }
+    size_t file_size = st.st_size;
+    size_t mem_size = header.first.capacity + ARENA_HEADER_SIZE;
+    if (!is_contiguous(&header) || file_size % sys_page_size
+        || ARENA_HEADER_SIZE + header.first.tail > file_size || file_size > mem_size) {
+        fprintf(stderr, "%s: %s is not an arena snapshot\n", __func__, path);
+        close(fd);
+        return nullptr;
+    }
+
+    // reserve full range so that writable arena can grow and delete_arena works as usual
+    Arena* arena = reserve_pages(mem_size, 0, nullptr);
+    if (!arena) {
+        close(fd);
+        return nullptr;
+    }
+    int prot = writable? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void* mem = mmap(arena, file_size, prot, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "%s mmap(%s): %s\n", __func__, path, strerror(errno));
+        free_mem(arena, mem_size);
+        return nullptr;
+    }
+    if (writable) {
+        // fix up absolute pointers and mapping state
+        arena->last = &arena->first;
+        arena->committed = file_size;
+        arena->page_flags = 0;
+        arena->obtained_page_flags = 0;
+    }
+    return arena;
+}
+
 void arena_print(FILE* fp, Arena* arena)
 {
     fprintf(fp, "Arena at %p\n", (void*) arena);
     fprintf(fp, "last region: %p\n", (void*) arena->last);
     fprintf(fp, "new_region_capacity: %u\n", arena->new_region_capacity);
+    fprintf(fp, "growth_policy: %d, max_region_capacity: %u\n", arena->growth_policy, arena->max_region_capacity);
+    fprintf(fp, "page_flags: requested %u, obtained %u\n", arena->page_flags, arena->obtained_page_flags);
+    if (is_contiguous(arena)) {
+        fprintf(fp, "committed: %zu\n", arena->committed);
+    }
     fprintf(fp, "first region -> next: %p\n", (void*) arena->first.next);
-    fprintf(fp, "first region -> tail: %u\n", arena->first.tail);
-    fprintf(fp, "first region -> capacity: %u\n", arena->first.capacity);
+    fprintf(fp, "first region -> tail: %zu\n", arena->first.tail);
+    fprintf(fp, "first region -> capacity: %zu\n", arena->first.capacity);
     for (Region* region = arena->first.next; region != nullptr; region = region->next) {
         fprintf(fp, "\nRegion %p\n", (void*) region);
         fprintf(fp, "next region: %p\n", (void*) region->next);
-        fprintf(fp, "tail: %u\n", region->tail);
-        fprintf(fp, "capacity: %u\n", region->capacity);
+        fprintf(fp, "tail: %zu\n", region->tail);
+        fprintf(fp, "capacity: %zu\n", region->capacity);
     }
 }
@@ -0,0 +1,129 @@
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <threads.h>
+
+#include "arena.h"
+#include "allocator.h"
+
+/*
+ * Thread-safe arena.
+ *
+ * Blocks are carved from chunks with atomic increment of the chunk tail.
+ * Chunks are allocated from the backing arena and the lock is taken
+ * only when the current chunk is exhausted.
+ */
+
+#define QUANTUM  alignof(max_align_t)  // allocation sizes are rounded to quantum to keep blocks aligned
+
+typedef struct {
+    atomic_size_t tail;
+    size_t capacity;
+    alignas(max_align_t) uint8_t data[];
+} Chunk;
+
+struct _SyncArena {
+    Arena* arena;  // backing arena, accessed under lock
+    mtx_t lock;
+    _Atomic(Chunk*) chunk;  // current chunk
+    unsigned chunk_size;
+};
+
+static Chunk* new_chunk(SyncArena* sarena)
+/*
+ * Allocate new chunk from backing arena. Must be called with lock held.
+ */
+{
+    static_assert(alignof(Chunk) <= alignof(max_align_t));  // arena does not support bigger alignment
+
+    Chunk* chunk = _arena_alloc(sarena->arena, sizeof(Chunk) + sarena->chunk_size, alignof(Chunk));
+    if (chunk) {
+        assert(((uintptr_t) chunk & (alignof(Chunk) - 1)) == 0);
+        atomic_init(&chunk->tail, 0);
+        chunk->capacity = sarena->chunk_size;
+    }
+    return chunk;
+}
+
+static void* locked_alloc(SyncArena* sarena, unsigned size, unsigned alignment)
+/*
+ * Allocate block directly from the backing arena.
+ */
+{
+    mtx_lock(&sarena->lock);
+    void* result;
+    if (alignment <= QUANTUM) {
+        result = _arena_alloc(sarena->arena, size, alignment);
+    } else {
+        result = _arena_alloc(sarena->arena, size + alignment, QUANTUM);
+        if (result) {
+            result = align_pointer(result, alignment);
+        }
+    }
+    mtx_unlock(&sarena->lock);
+    return result;
+}
+
+SyncArena* create_sync_arena(unsigned chunk_size)
+{
+    chunk_size = align_unsigned(chunk_size, QUANTUM);
+
+    // the arena structure itself lives in the backing arena
+    Arena* arena = create_arena(sizeof(SyncArena) + sizeof(Chunk) + chunk_size + QUANTUM);
+    if (!arena) {
+        return nullptr;
+    }
+    SyncArena* sarena = arena_alloc(arena, 1, SyncArena);
+    sarena->arena = arena;
+    sarena->chunk_size = chunk_size;
+    if (mtx_init(&sarena->lock, mtx_plain) != thrd_success) {
+        fprintf(stderr, "%s: cannot init mutex\n", __func__);
+        delete_arena(arena);
+        return nullptr;
+    }
+    Chunk* chunk = new_chunk(sarena);
+    if (!chunk) {
+        mtx_destroy(&sarena->lock);
+        delete_arena(arena);
+        return nullptr;
+    }
+    atomic_init(&sarena->chunk, chunk);
+    return sarena;
+}
+
+void delete_sync_arena(SyncArena* sarena)
+{
+    mtx_destroy(&sarena->lock);
+    delete_arena(sarena->arena);
+}
+
+void* _sync_arena_alloc(SyncArena* sarena, unsigned size, unsigned alignment)
+{
+    size_t nbytes = align_unsigned(size, QUANTUM);
+    if (alignment > QUANTUM) {
+        nbytes += alignment - QUANTUM;
+    }
+    if (nbytes > sarena->chunk_size / 4) {
+        // big blocks would waste too much of chunk
+        return locked_alloc(sarena, size, alignment);
+    }
+    for (;;) {
+        Chunk* chunk = atomic_load_explicit(&sarena->chunk, memory_order_acquire);
+        size_t start = atomic_fetch_add_explicit(&chunk->tail, nbytes, memory_order_relaxed);
+        if (start + nbytes <= chunk->capacity) {
+            return align_pointer(&chunk->data[start], alignment);
+        }
+        // chunk is exhausted, replace it unless other thread has already done that
+        mtx_lock(&sarena->lock);
+        if (atomic_load_explicit(&sarena->chunk, memory_order_relaxed) == chunk) {
+            Chunk* next_chunk = new_chunk(sarena);
+            if (!next_chunk) {
+                mtx_unlock(&sarena->lock);
+                return nullptr;
+            }
+            atomic_store_explicit(&sarena->chunk, next_chunk, memory_order_release);
+        }
+        mtx_unlock(&sarena->lock);
+    }
+}
@@ -1,11 +1,14 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
+#include <threads.h>
 #include <unistd.h>
 
 #include "allocator.h"  // for align_unsigned
 #include "dump.h"
 #include "fsb_arena.h"
+#include "mmarray.h"
+#include "pages.h"
 #include "src/word.h"
 
 struct _FsbaPageHeader {
@@ -13,7 +16,12 @@ struct _FsbaPageHeader {
     struct _FsbaPageHeader* next;
     struct _FsbaPageHeader* prev;
     unsigned num_free;
+    unsigned first_free;  // index of the first bitmap word that may have free bits
+    unsigned page_index;  // handle mode only: index in the page table
+    unsigned color_offset;  // offset of the first block from the end of header
+    bool retained;          // empty page counted in num_empty_pages
     Word bitmap[ /* bitmap_size */ ];
+    // handle mode only: uint8_t generations[ bitmap_size * WORD_WIDTH ];
 };
 
 static void add_to_list(FsbaPageHeader** list, FsbaPageHeader* page)
@@ -39,7 +47,7 @@ static void delete_from_list(FsbaPageHeader** list, FsbaPageHeader* page)
  * Delete page from circular doubly-linked list.
  */
 {
-    if (page->next == page->prev) {
+    if (page->next == page) {
         // last page, make list empty
         *list = nullptr;
     } else {
@@ -51,32 +59,167 @@ static void delete_from_list(FsbaPageHeader** list, FsbaPageHeader* page)
     }
 }
 
-static inline void free_page(FsbaPageHeader* page)
+/*
+ * Block storage is organized in slabs. Slab is a power of two number of pages
+ * aligned at its size, so the header is found by masking block address.
+ * By default slab is a single page if the block fits in it. Otherwise,
+ * or if the caller asks for it, slab size is chosen so that no more than
+ * 1/FSB_MAX_WASTE_RATIO of the slab is wasted, or the waste is minimal.
+ * In the code below slabs are called pages for historical reasons.
+ */
+
+#define FSB_MAX_SLAB_SIZE    (1024 * 1024)
+#define FSB_MAX_WASTE_RATIO  8
+#define DEFAULT_SLAB_SIZE    UINT_MAX  // single page if the block fits in it
+
+static unsigned count_pages(FsbaPageHeader* first_page)
 {
-    munmap(page, sys_page_size);
+    unsigned n = 0;
+    if (first_page) {
+        FsbaPageHeader* page = first_page;
+        do {
+            n++;
+            page = page->next;
+        } while (page != first_page);
+    }
+    return n;
 }
 
-bool _init_fsb_arena(FsbArena* arena, unsigned block_size, unsigned block_alignment)
+static inline uint8_t* block_address(FsbArena* arena, FsbaPageHeader* page, unsigned index);
+
+static inline void free_page(FsbArena* arena, FsbaPageHeader* page)
 {
-    if (block_size < block_alignment) {
-        arena->block_size = block_alignment;
-    } else {
-        arena->block_size = block_size;
+    if (arena->dtor) {
+        for (unsigned i = 0, n = arena->blocks_per_page; i < n; i++) {
+            arena->dtor(block_address(arena, page, i), arena->hook_data);
+        }
     }
-    unsigned header_size = align_unsigned(sizeof(FsbaPageHeader) + sizeof(Word), arena->block_size);
-    unsigned max_block_size = sys_page_size - header_size;
+    unmap_pages(page, arena->slab_size);
+    arena->munmap_calls++;
+}
+
+static inline unsigned calc_header_size(unsigned bitmap_size, unsigned block_alignment, bool handles)
+{
+    unsigned generations_size = handles? bitmap_size * WORD_WIDTH : 0;
+    return align_unsigned(sizeof(FsbaPageHeader) + sizeof(Word) * bitmap_size + generations_size, block_alignment);
+}
+
+static unsigned calc_layout(unsigned slab_size, unsigned block_size, unsigned block_alignment,
+                            bool handles, unsigned* bitmap_size)
+/*
+ * Calculate bitmap size and return the number of blocks per slab.
+ */
+{
+    unsigned num_blocks;
+    *bitmap_size = 0;
+    do {
+        (*bitmap_size)++;
+        unsigned header_size = calc_header_size(*bitmap_size, block_alignment, handles);
+        if (header_size + block_size > slab_size) {
+            return 0;
+        }
+        num_blocks = (slab_size - header_size) / block_size;
+    } while (num_blocks > (*bitmap_size * WORD_WIDTH));
+    return num_blocks;
+}
+
+static unsigned choose_slab_size(unsigned block_size, unsigned block_alignment, bool handles)
+/*
+ * Return the smallest slab size that keeps waste within the limit,
+ * or the one with minimal waste. Return 0 if the block is too big.
+ */
+{
+    unsigned best_slab_size = 0;
+    unsigned best_waste = 0;
+    for (unsigned slab_size = sys_page_size; slab_size <= FSB_MAX_SLAB_SIZE; slab_size *= 2) {
+        unsigned bitmap_size;
+        unsigned num_blocks = calc_layout(slab_size, block_size, block_alignment, handles, &bitmap_size);
+        if (num_blocks == 0) {
+            continue;
+        }
+        unsigned waste = slab_size - num_blocks * block_size;
+        if (best_slab_size == 0 || ((size_t) waste) * best_slab_size < ((size_t) best_waste) * slab_size) {
+            best_slab_size = slab_size;
+            best_waste = waste;
+        }
+        if (waste * FSB_MAX_WASTE_RATIO <= slab_size) {
+            break;
+        }
+    }
+    return best_slab_size;
+}
 
-    if (arena->block_size > max_block_size) {
+static bool init_arena(FsbArena* arena, unsigned block_size, unsigned block_alignment,
+                       unsigned slab_size, bool handles)
+/*
+ * `slab_size` is a power of two multiple of page size,
+ * DEFAULT_SLAB_SIZE or FSB_AUTO_SLAB_SIZE.
+ */
+{
+    if (block_alignment == 0) {
+        block_alignment = 1;
+    }
+    if (block_size == 0 || block_alignment > sys_page_size) {
         return false;
     }
+    arena->block_size = align_unsigned(block_size, block_alignment);
+    arena->block_alignment = block_alignment;
 
-    // calculate bitmap size and blocks per page
-    arena->bitmap_size = 0;
-    do {
-        arena->bitmap_size++;
-        header_size = align_unsigned(sizeof(FsbaPageHeader) + sizeof(Word) * arena->bitmap_size, arena->block_size);
-        arena->blocks_per_page = (sys_page_size - header_size) / arena->block_size;
-    } while (arena->blocks_per_page > (arena->bitmap_size * WORD_WIDTH));
+    unsigned bitmap_size;
+    if (slab_size == DEFAULT_SLAB_SIZE) {
+        if (calc_layout(sys_page_size, arena->block_size, block_alignment, handles, &bitmap_size)) {
+            slab_size = sys_page_size;
+        } else {
+            slab_size = FSB_AUTO_SLAB_SIZE;
+        }
+    }
+    if (slab_size == FSB_AUTO_SLAB_SIZE) {
+        slab_size = choose_slab_size(arena->block_size, block_alignment, handles);
+        if (slab_size == 0) {
+            return false;
+        }
+    }
+    if (slab_size < sys_page_size || slab_size > FSB_MAX_SLAB_SIZE || (slab_size & (slab_size - 1))) {
+        return false;
+    }
+    arena->slab_size = slab_size;
+    arena->blocks_per_page = calc_layout(slab_size, arena->block_size, block_alignment, handles, &arena->bitmap_size);
+    if (arena->blocks_per_page == 0) {
+        return false;
+    }
+    arena->header_size = calc_header_size(arena->bitmap_size, block_alignment, handles);
+
+    arena->first_free_hint = true;
+
+    arena->max_empty_pages = 0;
+    arena->num_empty_pages = 0;
+    arena->mmap_calls = 0;
+    arena->munmap_calls = 0;
+    arena->pages_reused = 0;
+
+    arena->color_step = (block_alignment > FSB_CACHE_LINE_SIZE)? block_alignment : FSB_CACHE_LINE_SIZE;
+    arena->num_colors = 1;
+    arena->next_color = 0;
+
+    arena->ctor = nullptr;
+    arena->dtor = nullptr;
+    arena->hook_data = nullptr;
+
+    arena->page_table = nullptr;
+    arena->slot_bits = 0;
+    if (handles) {
+        unsigned max_slot = arena->blocks_per_page - 1;
+        arena->slot_bits = max_slot? 32 - __builtin_clz(max_slot) : 0;
+        if (arena->slot_bits > FSB_HANDLE_INDEX_BITS - 1) {
+            return false;
+        }
+        // page index 0 is reserved for null handle
+        arena->page_table = mmarray_try_allocate(1, sizeof(FsbaPageHeader*), 0);
+        if (!arena->page_table) {
+            return false;
+        }
+        ((FsbaPageHeader**) arena->page_table)[0] = nullptr;
+    }
 
     // initialize lists
     arena->avail_pages = nullptr;
@@ -84,140 +227,548 @@ bool _init_fsb_arena(FsbArena* arena, unsigned block_size, unsigned block_alignm
     return true;
 }
 
-void destroy_fsb_arena(FsbArena* arena)
+bool _init_fsb_pool(FsbArena* arena, unsigned block_size, unsigned block_alignment,
+                    FsbBlockHook ctor, FsbBlockHook dtor, void* hook_data)
 {
-    FsbaPageHeader* page = arena->avail_pages;
-    FsbaPageHeader* next;
-    if (page) {
-        do {
-            next = page->next;
-            free_page(page);
-        } while (page != next);
+    if (!init_arena(arena, block_size, block_alignment, DEFAULT_SLAB_SIZE, false)) {
+        return false;
+    }
+    arena->ctor = ctor;
+    arena->dtor = dtor;
+    arena->hook_data = hook_data;
+
+    // unmapping empty pages would throw away constructed blocks
+    arena->max_empty_pages = UINT_MAX;
+    return true;
+}
+
+void fsb_arena_set_coloring(FsbArena* arena, bool enable)
+{
+    unsigned num_colors = 1;
+    if (enable) {
+        unsigned slack = arena->slab_size - arena->header_size - arena->blocks_per_page * arena->block_size;
+        num_colors = slack / arena->color_step + 1;
     }
-    page = arena->full_pages;
-    if (page) {
+    arena->num_colors = num_colors;
+    arena->next_color = 0;
+}
+
+bool _init_fsb_arena(FsbArena* arena, unsigned block_size, unsigned block_alignment)
+{
+    return init_arena(arena, block_size, block_alignment, DEFAULT_SLAB_SIZE, false);
+}
+
+bool _init_fsb_arena_with_slab_size(FsbArena* arena, unsigned block_size, unsigned block_alignment, unsigned slab_size)
+{
+    return init_arena(arena, block_size, block_alignment, slab_size, false);
+}
+
+bool _init_fsb_arena_with_handles(FsbArena* arena, unsigned block_size, unsigned block_alignment)
+{
+    return init_arena(arena, block_size, block_alignment, DEFAULT_SLAB_SIZE, true);
+}
+
+static void free_pages(FsbArena* arena, FsbaPageHeader* first_page)
+{
+    if (first_page) {
+        FsbaPageHeader* page = first_page;
         do {
-            next = page->next;
-            free_page(page);
-        } while (page != next);
+            FsbaPageHeader* next = page->next;
+            free_page(arena, page);
+            page = next;
+        } while (page != first_page);
     }
+}
+
+void destroy_fsb_arena(FsbArena* arena)
+{
+    free_pages(arena, arena->avail_pages);
+    free_pages(arena, arena->full_pages);
     arena->avail_pages = nullptr;
     arena->full_pages = nullptr;
+    arena->num_empty_pages = 0;
+    if (arena->page_table) {
+        mmarray_free(arena->page_table);
+        arena->page_table = nullptr;
+    }
 }
 
-void* fsb_arena_allocate(FsbArena* arena)
+static inline uint8_t* get_generations(FsbArena* arena, FsbaPageHeader* page)
+{
+    return (uint8_t*) &page->bitmap[arena->bitmap_size];
+}
+
+static FsbaPageHeader* get_avail_page(FsbArena* arena)
+/*
+ * Return the first available page, allocate new one if necessary.
+ */
 {
     FsbaPageHeader* page = arena->avail_pages;
     if (!page) {
         // allocate new page
-        page = mmap(nullptr, sys_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (page == MAP_FAILED) {
+        if (arena->slab_size == sys_page_size) {
+            page = map_pages(sys_page_size, 0, nullptr);
+        } else {
+            page = map_aligned_pages(arena->slab_size, arena->slab_size, 0, nullptr);
+        }
+        if (!page) {
             return nullptr;
         }
+        arena->mmap_calls++;
+        page->color_offset = arena->next_color * arena->color_step;
+        if (++arena->next_color >= arena->num_colors) {
+            arena->next_color = 0;
+        }
+        page->page_index = 0;
+        if (arena->page_table) {
+            // register page in the page table
+            unsigned page_index = mmarray_length(arena->page_table);
+            if (page_index >= (1U << (FSB_HANDLE_INDEX_BITS - arena->slot_bits))) {
+                free_page(arena, page);
+                return nullptr;
+            }
+            void* page_table = mmarray_try_append_item(arena->page_table, &page);
+            if (!page_table) {
+                free_page(arena, page);
+                return nullptr;
+            }
+            arena->page_table = page_table;
+            page->page_index = page_index;
+        }
         page->arena = arena;
+        page->retained = false;
         page->num_free = arena->blocks_per_page;
+        page->first_free = 0;
         Word* bitmap = page->bitmap;
         for (unsigned i = 0, n = arena->bitmap_size; i < n; i++) {
             *bitmap++ = 0;
         }
+        if (arena->page_table) {
+            uint8_t* generations = get_generations(arena, page);
+            for (unsigned i = 0, n = arena->blocks_per_page; i < n; i++) {
+                generations[i] = 0;
+            }
+        }
+        if (arena->ctor) {
+            for (unsigned i = 0, n = arena->blocks_per_page; i < n; i++) {
+                arena->ctor(block_address(arena, page, i), arena->hook_data);
+            }
+        }
         add_to_list(&arena->avail_pages, page);
+    } else if (page->retained) {
+        page->retained = false;
+        arena->num_empty_pages--;
+        arena->pages_reused++;
+    }
+    return page;
+}
+
+static inline void page_blocks_allocated(FsbArena* arena, FsbaPageHeader* page, unsigned num_blocks)
+{
+    // decrement free blocks counter
+    page->num_free -= num_blocks;
+    if (page->num_free == 0) {
+        // the page is full, move it from avail_pages to full_pages
+        delete_from_list(&arena->avail_pages, page);
+        add_to_list(&arena->full_pages, page);
+    }
+}
+
+static inline unsigned block_index(FsbArena* arena, FsbaPageHeader* page, void* block)
+{
+    return (((uint8_t*) block) - ((uint8_t*) page) - arena->header_size - page->color_offset) / arena->block_size;
+}
+
+static inline uint8_t* block_address(FsbArena* arena, FsbaPageHeader* page, unsigned index)
+{
+    return ((uint8_t*) page) + arena->header_size + page->color_offset + index * arena->block_size;
+}
+
+void* fsb_arena_allocate(FsbArena* arena)
+{
+    FsbaPageHeader* page = get_avail_page(arena);
+    if (!page) {
+        return nullptr;
     }
-    // find available position in the bitmap
+    // find available position in the bitmap, starting from the first word that may have free bits
     unsigned bitmap_size = arena->bitmap_size;
-    Word* bitmap = page->bitmap;
-    for (unsigned i = 0; i < bitmap_size; i++, bitmap++) {
+    unsigned first_free = arena->first_free_hint? page->first_free : 0;
+    Word* bitmap = &page->bitmap[first_free];
+    for (unsigned i = first_free; i < bitmap_size; i++, bitmap++) {
         Word w = ~*bitmap;
         if (w) {
             // found, do allocate
-            unsigned block_size = arena->block_size;
-            unsigned header_size = align_unsigned(sizeof(FsbaPageHeader) + sizeof(Word) * bitmap_size, block_size);
             unsigned bit_index = count_trailing_zeros(w);
             *bitmap |= ((Word) 1) << bit_index;
-
-            // decrement free blocks counter
-            page->num_free--;
-            if (page->num_free == 0) {
-                // the page is full, move it from avail_pages to full_pages
-                delete_from_list(&arena->avail_pages, page);
-                add_to_list(&arena->full_pages, page);
-            }
-            return ((uint8_t*) page) + header_size + (i * WORD_WIDTH + bit_index) * block_size;
+            page->first_free = (w & (w - 1))? i : i + 1;
+            page_blocks_allocated(arena, page, 1);
+            return block_address(arena, page, i * WORD_WIDTH + bit_index);
         }
     }
     fputs("FSB arena: bad bitmap\n", stderr);
     abort();
 }
 
-void fsb_arena_release(void** block_ptr)
+unsigned fsb_arena_allocate_n(FsbArena* arena, unsigned n, void** blocks)
 {
-    void* block = *block_ptr;
-    if (!block) {
-        return;
+    unsigned num_allocated = 0;
+    while (num_allocated < n) {
+        FsbaPageHeader* page = get_avail_page(arena);
+        if (!page) {
+            break;
+        }
+        unsigned bitmap_size = arena->bitmap_size;
+        unsigned num_claimed = 0;
+        unsigned first_free = arena->first_free_hint? page->first_free : 0;
+        for (unsigned i = first_free; i < bitmap_size && num_allocated < n; i++) {
+            Word free_bits = ~page->bitmap[i];
+            if (!free_bits) {
+                continue;
+            }
+            // exclude bits beyond the last block
+            unsigned first_index = i * WORD_WIDTH;
+            if (arena->blocks_per_page - first_index < WORD_WIDTH) {
+                free_bits &= (((Word) 1) << (arena->blocks_per_page - first_index)) - 1;
+            }
+            // claim free bits, up to the number of blocks requested
+            Word claimed = 0;
+            while (free_bits && num_allocated < n) {
+                unsigned bit_index = count_trailing_zeros(free_bits);
+                free_bits &= free_bits - 1;
+                claimed |= ((Word) 1) << bit_index;
+                blocks[num_allocated++] = block_address(arena, page, first_index + bit_index);
+                num_claimed++;
+            }
+            page->bitmap[i] |= claimed;
+            page->first_free = (~page->bitmap[i])? i : i + 1;
+        }
+        page_blocks_allocated(arena, page, num_claimed);
     }
-    *block_ptr = nullptr;
+    return num_allocated;
+}
 
-    // get page from block address
-    FsbaPageHeader* page = (FsbaPageHeader*)( ((ptrdiff_t) block) & ~(ptrdiff_t) (sys_page_size - 1) );
+static inline FsbaPageHeader* get_page(void* block, unsigned slab_size)
+{
+    return (FsbaPageHeader*)( ((ptrdiff_t) block) & ~(ptrdiff_t) (slab_size - 1) );
+}
+
+FsbArena* fsb_arena_of(void* block)
+{
+    return get_page(block, sys_page_size)->arena;
+}
 
+static inline void clear_block_bit(FsbArena* arena, FsbaPageHeader* page, void* block)
+{
     // calculate bit index in the bitmap
-    FsbArena* arena = page->arena;
-    unsigned offset = ((uint8_t*) block) - ((uint8_t*) page);
-    unsigned block_size = arena->block_size;
-    unsigned header_size = align_unsigned(sizeof(FsbaPageHeader) + sizeof(Word) * arena->bitmap_size, block_size);
-    unsigned index = (offset - header_size) / block_size;
+    unsigned index = block_index(arena, page, block);
 
     // clear bit
-    page->bitmap[index / WORD_WIDTH] &= ~(((Word) 1) << (index & (WORD_WIDTH - 1)));
+    unsigned word_index = index / WORD_WIDTH;
+    page->bitmap[word_index] &= ~(((Word) 1) << (index & (WORD_WIDTH - 1)));
+    if (word_index < page->first_free) {
+        page->first_free = word_index;
+    }
+    if (arena->page_table) {
+        // invalidate handles
+        get_generations(arena, page)[index]++;
+    }
+}
 
+static void page_blocks_released(FsbArena* arena, FsbaPageHeader* page, unsigned num_blocks)
+{
     // increment free blocks counter
-    page->num_free++;
+    bool was_full = page->num_free == 0;
+    page->num_free += num_blocks;
+    if (was_full) {
+        // move page from full_pages to avail_pages
+        delete_from_list(&arena->full_pages, page);
+        add_to_list(&arena->avail_pages, page);
+    }
     if (page->num_free == arena->blocks_per_page) {
         // entire page is free now
         FsbaPageHeader* list = arena->avail_pages;
-        if (list->next != list->prev) {
-            // not the last page, reclaim it back to the operating system
+        if (list->next == list) {
+            // the last page, keep it without counting as retained:
+            // reusing it saves nothing
+            return;
+        }
+        if (arena->num_empty_pages < arena->max_empty_pages || arena->page_table) {
+            // pages are never unmapped in handle mode
+            // retain the page and move it to the end of list
+            // so that partially used pages are filled first
+            page->retained = true;
+            arena->num_empty_pages++;
             delete_from_list(&arena->avail_pages, page);
-            free_page(page);
+            add_to_list(&arena->avail_pages, page);
+            arena->avail_pages = page->next;
+        } else {
+            // reclaim it back to the operating system
+            delete_from_list(&arena->avail_pages, page);
+            free_page(arena, page);
         }
-    } else if (page->num_free == 1) {
-        // the page was full, move it from full_pages to avail_pages
-        delete_from_list(&arena->full_pages, page);
-        add_to_list(&arena->avail_pages, page);
     }
 }
 
-void fsb_arena_walk(FsbArena* arena, FsbArenaWalkCb callback, void* cb_data)
+static void release_block(FsbArena* arena, FsbaPageHeader* page, void* block)
 {
-    if (arena->avail_pages == nullptr) {
+    clear_block_bit(arena, page, block);
+    page_blocks_released(arena, page, 1);
+}
+
+void fsb_arena_release(void** block_ptr)
+{
+    void* block = *block_ptr;
+    if (!block) {
+        return;
+    }
+    *block_ptr = nullptr;
+
+    FsbaPageHeader* page = get_page(block, sys_page_size);
+    release_block(page->arena, page, block);
+}
+
+void fsb_arena_free(FsbArena* arena, void** block_ptr)
+{
+    void* block = *block_ptr;
+    if (!block) {
+        return;
+    }
+    *block_ptr = nullptr;
+
+    release_block(arena, get_page(block, arena->slab_size), block);
+}
+
+void fsb_arena_release_n(FsbArena* arena, unsigned n, void** blocks)
+{
+    unsigned i = 0;
+    while (i < n) {
+        void* block = blocks[i];
+        if (!block) {
+            i++;
+            continue;
+        }
+        // release adjacent blocks that belong to the same page at once
+        FsbaPageHeader* page = get_page(block, arena->slab_size);
+        unsigned num_released = 0;
+        for (; i < n; i++) {
+            block = blocks[i];
+            if (!block) {
+                continue;
+            }
+            if (get_page(block, arena->slab_size) != page) {
+                break;
+            }
+            clear_block_bit(arena, page, block);
+            blocks[i] = nullptr;
+            num_released++;
+        }
+        page_blocks_released(arena, page, num_released);
+    }
+}
+
+unsigned fsb_arena_trim(FsbArena* arena)
+{
+    if (arena->page_table) {
+        // pages are never unmapped in handle mode
+        return 0;
+    }
+    unsigned num_released = 0;
+    FsbaPageHeader* page = arena->avail_pages;
+    for (unsigned n = count_pages(arena->avail_pages); n; n--) {
+        FsbaPageHeader* next_page = page->next;
+        if (page->num_free == arena->blocks_per_page) {
+            delete_from_list(&arena->avail_pages, page);
+            free_page(arena, page);
+            num_released++;
+        }
+        page = next_page;
+    }
+    arena->num_empty_pages = 0;
+    return num_released;
+}
+
+/*
+ * Handles.
+ */
+
+#define GENERATION_BITS  (32 - FSB_HANDLE_INDEX_BITS)
+#define GENERATION_MASK  ((1U << GENERATION_BITS) - 1)
+
+FsbHandle fsb_arena_ptr_to_handle(FsbArena* arena, void* block)
+{
+    if (!block || !arena->page_table) {
+        return 0;
+    }
+    FsbaPageHeader* page = get_page(block, arena->slab_size);
+    unsigned index = block_index(arena, page, block);
+    return (((page->page_index << arena->slot_bits) | index) << GENERATION_BITS)
+           | get_generations(arena, page)[index];
+}
+
+FsbHandle fsb_arena_allocate_handle(FsbArena* arena)
+{
+    return fsb_arena_ptr_to_handle(arena, fsb_arena_allocate(arena));
+}
+
+void* fsb_arena_handle_to_ptr(FsbArena* arena, FsbHandle handle)
+{
+    unsigned index = (handle >> GENERATION_BITS) & ((1U << arena->slot_bits) - 1);
+    unsigned page_index = handle >> (GENERATION_BITS + arena->slot_bits);
+    if (page_index == 0 || !arena->page_table || page_index >= mmarray_length(arena->page_table) || index >= arena->blocks_per_page) {
+        return nullptr;
+    }
+    FsbaPageHeader* page = ((FsbaPageHeader**) arena->page_table)[page_index];
+    if (get_generations(arena, page)[index] != (handle & GENERATION_MASK)) {
+        // stale handle
+        return nullptr;
+    }
+    if (!(page->bitmap[index / WORD_WIDTH] & (((Word) 1) << (index & (WORD_WIDTH - 1))))) {
+        // the slot is free, e.g. the handle was obtained for a released block
+        return nullptr;
+    }
+    return block_address(arena, page, index);
+}
+
+bool fsb_arena_release_handle(FsbArena* arena, FsbHandle handle)
+{
+    void* block = fsb_arena_handle_to_ptr(arena, handle);
+    if (!block) {
+        return false;
+    }
+    release_block(arena, get_page(block, arena->slab_size), block);
+    return true;
+}
+
+static void walk_page(FsbArena* arena, FsbaPageHeader* page, FsbArenaWalkCb callback, void* cb_data)
+/*
+ * Invoke `callback` for each allocated block on the page.
+ * When the last block is released by the callback, the page may be unmapped,
+ * so the page is not touched after that.
+ */
+{
+    unsigned blocks_per_page = arena->blocks_per_page;
+    if (page->num_free == blocks_per_page) {
         return;
     }
     unsigned bitmap_size = arena->bitmap_size;
     unsigned block_size = arena->block_size;
-    unsigned header_size = align_unsigned(sizeof(FsbaPageHeader) + sizeof(Word) * bitmap_size, block_size);
-    FsbaPageHeader* first_page = arena->avail_pages;
-    FsbaPageHeader* page = first_page;
-    do {
-        FsbaPageHeader* next_page = page->next;  // get next page in advance because the block can be released from callback
-        Word* bitmap = page->bitmap;
-        uint8_t* block_ptr = ((uint8_t*) page) + header_size;
-        for (unsigned i = 0; i < bitmap_size; i++) {
-            Word w = *bitmap++;
-            Word mask = 1;
-            for (unsigned j = 0; j < WORD_WIDTH; j++, mask <<= 1) {
-                unsigned num_free = page->num_free;
-                if (w & mask) {
-                    callback(arena, cb_data, (void*) block_ptr);
-                    if (num_free >= arena->blocks_per_page - 1) {
-                        // it was the last block on the page
-                        goto page_done;
-                    }
-                }
-                block_ptr += block_size;
+    uint8_t* first_block = ((uint8_t*) page) + arena->header_size + page->color_offset;
+    for (unsigned i = 0; i < bitmap_size; i++) {
+        Word w = page->bitmap[i];
+        while (w) {
+            unsigned bit_index = count_trailing_zeros(w);
+            w &= w - 1;
+            unsigned num_free = page->num_free;
+            callback(arena, cb_data, first_block + (i * WORD_WIDTH + bit_index) * block_size);
+            if (num_free == blocks_per_page - 1) {
+                // it was the last block on the page
+                return;
             }
         }
-page_done:
+    }
+}
+
+static void walk_list(FsbArena* arena, FsbaPageHeader* first_page, FsbArenaWalkCb callback, void* cb_data)
+{
+    // Pages can be unmapped or moved to other list by callback,
+    // so the number of pages is counted in advance
+    // and the next page is obtained before walking current one.
+    FsbaPageHeader* page = first_page;
+    for (unsigned n = count_pages(first_page); n; n--) {
+        FsbaPageHeader* next_page = page->next;
+        walk_page(arena, page, callback, cb_data);
         page = next_page;
-    } while (page != first_page);
+    }
+}
+
+void fsb_arena_walk(FsbArena* arena, FsbArenaWalkCb callback, void* cb_data)
+{
+    // walk available pages first: full pages become available when
+    // a block is released from callback, this avoids visiting them twice
+    walk_list(arena, arena->avail_pages, callback, cb_data);
+    walk_list(arena, arena->full_pages, callback, cb_data);
+}
+
+typedef struct {
+    FsbArena* arena;
+    FsbaPageHeader** pages;
+    unsigned num_pages;
+    FsbArenaWalkCb callback;
+    void* cb_data;
+} WalkTask;
+
+static int walk_pages(void* arg)
+{
+    WalkTask* task = arg;
+    for (unsigned i = 0; i < task->num_pages; i++) {
+        walk_page(task->arena, task->pages[i], task->callback, task->cb_data);
+    }
+    return 0;
+}
+
+static FsbaPageHeader** collect_pages(FsbaPageHeader** pages, FsbaPageHeader* first_page)
+{
+    if (first_page) {
+        FsbaPageHeader* page = first_page;
+        do {
+            *pages++ = page;
+            page = page->next;
+        } while (page != first_page);
+    }
+    return pages;
+}
+
+#define MAX_WALK_THREADS  256
+
+bool fsb_arena_walk_parallel(FsbArena* arena, FsbArenaWalkCb callback, void* cb_data, unsigned num_threads)
+{
+    unsigned num_pages = count_pages(arena->avail_pages) + count_pages(arena->full_pages);
+    if (num_threads > num_pages) {
+        num_threads = num_pages;
+    }
+    if (num_threads > MAX_WALK_THREADS) {
+        num_threads = MAX_WALK_THREADS;
+    }
+    if (num_threads <= 1) {
+        fsb_arena_walk(arena, callback, cb_data);
+        return true;
+    }
+    unsigned memsize = num_pages * sizeof(FsbaPageHeader*);
+    FsbaPageHeader** pages = allocate(memsize, false);
+    if (!pages) {
+        return false;
+    }
+    collect_pages(collect_pages(pages, arena->avail_pages), arena->full_pages);
+
+    WalkTask tasks[MAX_WALK_THREADS];
+    thrd_t threads[MAX_WALK_THREADS];
+    bool started[MAX_WALK_THREADS];
+    unsigned start = 0;
+    for (unsigned i = 0; i < num_threads; i++) {
+        unsigned end = (unsigned) (((size_t) num_pages) * (i + 1) / num_threads);
+        tasks[i] = (WalkTask) {
+            .arena     = arena,
+            .pages     = &pages[start],
+            .num_pages = end - start,
+            .callback  = callback,
+            .cb_data   = cb_data
+        };
+        start = end;
+        // current thread takes the last part
+        started[i] = (i < num_threads - 1) && thrd_create(&threads[i], walk_pages, &tasks[i]) == thrd_success;
+    }
+    for (unsigned i = 0; i < num_threads; i++) {
+        if (!started[i]) {
+            walk_pages(&tasks[i]);
+        }
+    }
+    for (unsigned i = 0; i < num_threads; i++) {
+        if (started[i]) {
+            thrd_join(threads[i], nullptr);
+        }
+    }
+    release((void**) &pages, memsize);
+    return true;
 }
 
 static void dump_page(FsbaPageHeader* page)
@@ -228,8 +779,10 @@ static void dump_page(FsbaPageHeader* page)
 
 void dump_fsb_arena(FsbArena* arena)
 {
-    fprintf(stderr, "\nFSB arena: block_size=%u, blocks_per_page=%u, bitmap_size=%u, word_size=%zu\nAvailable pages:",
-            arena->block_size, arena->blocks_per_page, arena->bitmap_size, sizeof(Word));
+    fprintf(stderr, "\nFSB arena: block_size=%u, slab_size=%u, blocks_per_page=%u, bitmap_size=%u, word_size=%zu\n"
+            "empty pages: %u (max %u), mmap calls: %zu, munmap calls: %zu, pages reused: %zu\nAvailable pages:",
+            arena->block_size, arena->slab_size, arena->blocks_per_page, arena->bitmap_size, sizeof(Word),
+            arena->num_empty_pages, arena->max_empty_pages, arena->mmap_calls, arena->munmap_calls, arena->pages_reused);
     if (arena->avail_pages == nullptr) {
         fputs(" none\n", stderr);
     } else {
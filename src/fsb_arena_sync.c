@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "fsb_arena.h"
+
+/*
+ * Magazine holds up to 2 * batch_size free blocks.
+ * When it is empty, one batch is taken from the arena.
+ * When it is full, older half is returned to the arena
+ * and recently released blocks, which are likely hot in cache, remain.
+ */
+
+typedef struct _FsbMagazine {
+    struct _FsbMagazine* next;  // list of magazines of the arena
+    struct _FsbMagazine* prev;
+    SyncFsbArena* sfa;
+    unsigned num_blocks;
+    void* blocks[];
+} FsbMagazine;
+
+static inline unsigned magazine_capacity(SyncFsbArena* sfa)
+{
+    return sfa->batch_size * 2;
+}
+
+static inline unsigned magazine_memsize(SyncFsbArena* sfa)
+{
+    return sizeof(FsbMagazine) + sizeof(void*) * magazine_capacity(sfa);
+}
+
+static inline void* allocate_magazine(SyncFsbArena* sfa)
+{
+    if (sfa->magazine_allocator) {
+        return sfa->magazine_allocator->allocate(magazine_memsize(sfa), false);
+    } else {
+        return allocate(magazine_memsize(sfa), false);
+    }
+}
+
+static inline void release_magazine(SyncFsbArena* sfa, FsbMagazine** magazine_ptr)
+{
+    if (sfa->magazine_allocator) {
+        sfa->magazine_allocator->release((void**) magazine_ptr, magazine_memsize(sfa));
+    } else {
+        release((void**) magazine_ptr, magazine_memsize(sfa));
+    }
+}
+
+static void flush_blocks(SyncFsbArena* sfa, void** blocks, unsigned num_blocks)
+/*
+ * Return blocks to the arena. Must be called with lock held.
+ */
+{
+    fsb_arena_release_n(&sfa->arena, num_blocks, blocks);
+}
+
+static void unlink_magazine(FsbMagazine* magazine)
+/*
+ * Must be called with lock held.
+ */
+{
+    if (magazine->prev) {
+        magazine->prev->next = magazine->next;
+    } else {
+        magazine->sfa->magazines = magazine->next;
+    }
+    if (magazine->next) {
+        magazine->next->prev = magazine->prev;
+    }
+}
+
+static void delete_magazine(void* magazine_ptr)
+/*
+ * Thread exit destructor.
+ */
+{
+    FsbMagazine* magazine = magazine_ptr;
+    SyncFsbArena* sfa = magazine->sfa;
+
+    mtx_lock(&sfa->lock);
+    flush_blocks(sfa, magazine->blocks, magazine->num_blocks);
+    unlink_magazine(magazine);
+    mtx_unlock(&sfa->lock);
+
+    release_magazine(sfa, &magazine);
+}
+
+static FsbMagazine* get_magazine(SyncFsbArena* sfa)
+/*
+ * Get magazine of current thread, create if necessary.
+ */
+{
+    FsbMagazine* magazine = tss_get(sfa->magazine_key);
+    if (magazine) {
+        return magazine;
+    }
+    magazine = allocate_magazine(sfa);
+    if (!magazine) {
+        return nullptr;
+    }
+    magazine->sfa = sfa;
+    magazine->num_blocks = 0;
+    magazine->prev = nullptr;
+
+    mtx_lock(&sfa->lock);
+    magazine->next = sfa->magazines;
+    if (magazine->next) {
+        magazine->next->prev = magazine;
+    }
+    sfa->magazines = magazine;
+    mtx_unlock(&sfa->lock);
+
+    if (tss_set(sfa->magazine_key, magazine) != thrd_success) {
+        mtx_lock(&sfa->lock);
+        unlink_magazine(magazine);
+        mtx_unlock(&sfa->lock);
+        release_magazine(sfa, &magazine);
+        return nullptr;
+    }
+    return magazine;
+}
+
+static bool init_sync(SyncFsbArena* sfa, unsigned batch_size)
+{
+    sfa->batch_size = batch_size? batch_size : SFA_DEFAULT_BATCH_SIZE;
+    sfa->magazines = nullptr;
+    sfa->magazine_allocator = nullptr;
+    if (mtx_init(&sfa->lock, mtx_plain) != thrd_success) {
+        fprintf(stderr, "%s cannot init mutex\n", __func__);
+        return false;
+    }
+    if (tss_create(&sfa->magazine_key, delete_magazine) != thrd_success) {
+        fprintf(stderr, "%s cannot create thread-specific storage key\n", __func__);
+        mtx_destroy(&sfa->lock);
+        return false;
+    }
+    return true;
+}
+
+bool _sfa_init(SyncFsbArena* sfa, unsigned block_size, unsigned block_alignment, unsigned batch_size)
+{
+    return _init_fsb_arena(&sfa->arena, block_size, block_alignment) && init_sync(sfa, batch_size);
+}
+
+bool _sfa_init_with_slab_size(SyncFsbArena* sfa, unsigned block_size, unsigned block_alignment,
+                              unsigned slab_size, unsigned batch_size)
+{
+    return _init_fsb_arena_with_slab_size(&sfa->arena, block_size, block_alignment, slab_size)
+        && init_sync(sfa, batch_size);
+}
+
+void sfa_fini(SyncFsbArena* sfa)
+{
+    tss_delete(sfa->magazine_key);
+
+    // blocks in magazines belong to arena pages, just free magazines
+    for (FsbMagazine* magazine = sfa->magazines; magazine != nullptr;) {
+        FsbMagazine* next = magazine->next;
+        release_magazine(sfa, &magazine);
+        magazine = next;
+    }
+    sfa->magazines = nullptr;
+
+    mtx_destroy(&sfa->lock);
+    destroy_fsb_arena(&sfa->arena);
+}
+
+void* sfa_allocate(SyncFsbArena* sfa)
+{
+    FsbMagazine* magazine = get_magazine(sfa);
+    if (!magazine) {
+        return nullptr;
+    }
+    if (magazine->num_blocks == 0) {
+        // refill
+        mtx_lock(&sfa->lock);
+        magazine->num_blocks = fsb_arena_allocate_n(&sfa->arena, sfa->batch_size, magazine->blocks);
+        mtx_unlock(&sfa->lock);
+        if (magazine->num_blocks == 0) {
+            return nullptr;
+        }
+    }
+    return magazine->blocks[--magazine->num_blocks];
+}
+
+void sfa_free(SyncFsbArena* sfa, void** block_ptr)
+{
+    void* block = *block_ptr;
+    if (!block) {
+        return;
+    }
+    *block_ptr = nullptr;
+
+    FsbMagazine* magazine = get_magazine(sfa);
+    if (!magazine) {
+        // no memory for magazine, release directly
+        mtx_lock(&sfa->lock);
+        fsb_arena_free(&sfa->arena, &block);
+        mtx_unlock(&sfa->lock);
+        return;
+    }
+    if (magazine->num_blocks == magazine_capacity(sfa)) {
+        // flush older half
+        unsigned batch_size = sfa->batch_size;
+        mtx_lock(&sfa->lock);
+        flush_blocks(sfa, magazine->blocks, batch_size);
+        mtx_unlock(&sfa->lock);
+        memmove(magazine->blocks, &magazine->blocks[batch_size], (magazine->num_blocks - batch_size) * sizeof(void*));
+        magazine->num_blocks -= batch_size;
+    }
+    magazine->blocks[magazine->num_blocks++] = block;
+}
+
+void sfa_release(void** block_ptr)
+{
+    if (*block_ptr) {
+        // arena is the first member of SyncFsbArena
+        sfa_free((SyncFsbArena*) fsb_arena_of(*block_ptr), block_ptr);
+    }
+}
+
+void sfa_flush(SyncFsbArena* sfa)
+{
+    FsbMagazine* magazine = tss_get(sfa->magazine_key);
+    if (magazine && magazine->num_blocks) {
+        mtx_lock(&sfa->lock);
+        flush_blocks(sfa, magazine->blocks, magazine->num_blocks);
+        mtx_unlock(&sfa->lock);
+        magazine->num_blocks = 0;
+    }
+}
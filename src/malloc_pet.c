@@ -0,0 +1,226 @@
+/*
+ * Replacement for malloc family backed by pet allocator.
+ *
+ * Build target: pussy_malloc shared library. Usage:
+ *
+ *   LD_PRELOAD=/path/to/libpussy_malloc.so program
+ *
+ * Pet allocator requires the size of block for release and reallocate.
+ * The size is stored in the header that precedes each block.
+ * The header takes exactly one allocator unit, so the alignment is preserved.
+ *
+ * Caveat: there are no fork handlers yet, forking a multithreaded
+ * process while some thread is in the middle of allocation may deadlock the child.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <threads.h>
+
+#include "allocator.h"
+
+typedef struct {
+    size_t nbytes;  // total number of bytes allocated with pet allocator
+    size_t offset;  // offset of user block from the start of allocated memory
+} BlockHeader;
+
+static_assert(sizeof(BlockHeader) == 16, "header must take one allocator unit");
+
+/****************************************************************
+ * Initialization
+ */
+
+static atomic_int init_state = 0;  // 0: not initialized, 1: in progress, 2: done
+
+static inline void init_shim()
+{
+    if (atomic_load_explicit(&init_state, memory_order_acquire) == 2) {
+        return;
+    }
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&init_state, &expected, 1)) {
+        // this can be called before constructors of libpussy
+        if (sys_page_size == 0) {
+            sys_page_size = sysconf(_SC_PAGE_SIZE);
+        }
+        pet_allocator.init();
+        atomic_store_explicit(&init_state, 2, memory_order_release);
+    } else {
+        while (atomic_load_explicit(&init_state, memory_order_acquire) != 2) {
+            thrd_yield();
+        }
+    }
+}
+
+/****************************************************************
+ * Helpers
+ */
+
+static inline BlockHeader* get_header(void* ptr)
+{
+    return ((BlockHeader*) ptr) - 1;
+}
+
+static void* allocate_block(size_t size, size_t alignment, bool clean)
+/*
+ * Allocate block with header, alignment must be a power of two.
+ */
+{
+    init_shim();
+
+    size_t offset = sizeof(BlockHeader);
+    size_t nbytes = size + sizeof(BlockHeader);
+    if (alignment > sizeof(BlockHeader)) {
+        // blocks are aligned on unit boundary, so the aligned
+        // address is never farther than `alignment` bytes from the start
+        nbytes = size + alignment;
+    }
+    if (nbytes < size || nbytes > UINT_MAX) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    uint8_t* block = pet_allocator.allocate(nbytes, clean);
+    if (!block) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    if (alignment > sizeof(BlockHeader)) {
+        offset = ((uint8_t*) align_pointer(block + sizeof(BlockHeader), alignment)) - block;
+    }
+    void* result = block + offset;
+    BlockHeader* header = get_header(result);
+    header->nbytes = nbytes;
+    header->offset = offset;
+    return result;
+}
+
+static void release_block(void* ptr)
+{
+    BlockHeader* header = get_header(ptr);
+    void* block = ((uint8_t*) ptr) - header->offset;
+    pet_allocator.release(&block, header->nbytes);
+}
+
+static inline bool is_power_of_two(size_t n)
+{
+    return n && !(n & (n - 1));
+}
+
+/****************************************************************
+ * Malloc interface
+ */
+
+void* malloc(size_t size)
+{
+    return allocate_block(size, 0, false);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return allocate_block(total, 0, true);
+}
+
+void free(void* ptr)
+{
+    if (ptr) {
+        release_block(ptr);
+    }
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    if (!ptr) {
+        return allocate_block(size, 0, false);
+    }
+    if (size == 0) {
+        release_block(ptr);
+        return nullptr;
+    }
+    BlockHeader* header = get_header(ptr);
+    size_t usable_size = header->nbytes - header->offset;
+
+    if (header->offset == sizeof(BlockHeader)) {
+        // not an aligned block, let pet allocator do its best
+        size_t nbytes = size + sizeof(BlockHeader);
+        if (nbytes < size || nbytes > UINT_MAX) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        void* block = header;
+        if (!pet_allocator.reallocate(&block, header->nbytes, nbytes, false, nullptr)) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        header = block;
+        header->nbytes = nbytes;
+        return header + 1;
+    }
+
+    // aligned block: allocate new one, alignment is not preserved as in glibc
+    void* result = allocate_block(size, 0, false);
+    if (result) {
+        memcpy(result, ptr, (size < usable_size)? size : usable_size);
+        release_block(ptr);
+    }
+    return result;
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    if (!is_power_of_two(alignment) || alignment % sizeof(void*)) {
+        return EINVAL;
+    }
+    void* result = allocate_block(size, alignment, false);
+    if (!result) {
+        return ENOMEM;
+    }
+    *memptr = result;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    if (!is_power_of_two(alignment)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return allocate_block(size, alignment, false);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+void* valloc(size_t size)
+{
+    init_shim();
+    return allocate_block(size, sys_page_size, false);
+}
+
+void* pvalloc(size_t size)
+{
+    init_shim();
+    size_t aligned_size = (size + sys_page_size - 1) & ~((size_t) sys_page_size - 1);
+    if (aligned_size < size) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return allocate_block(aligned_size, sys_page_size, false);
+}
+
+size_t malloc_usable_size(void* ptr)
+{
+    if (!ptr) {
+        return 0;
+    }
+    BlockHeader* header = get_header(ptr);
+    return header->nbytes - header->offset;
+}
@@ -2,6 +2,7 @@
 #   define _GNU_SOURCE
 #endif
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,12 +10,13 @@
 #include <sys/mman.h>
 
 #include "mmarray.h"
+#include "pages.h"
 
 typedef struct {
     unsigned capacity;
     unsigned length;
     unsigned item_size;
-    unsigned padding;
+    unsigned page_flags;  // PAGES_* options obtained for the array
 } ArrayHeader;
 
 static size_t page_size = 0;
@@ -26,10 +28,9 @@ static inline void get_page_size()
     }
 }
 
-static size_t calc_memsize(unsigned capacity, unsigned item_size)
+static size_t calc_memsize(unsigned capacity, unsigned item_size, unsigned page_flags)
 {
-    get_page_size();
-    return (sizeof(ArrayHeader) + ((size_t) capacity) * item_size + page_size - 1) & ~(page_size - 1);
+    return align_to_pages(sizeof(ArrayHeader) + ((size_t) capacity) * item_size, page_flags);
 }
 
 static inline ArrayHeader* get_array_header(void* array)
@@ -42,33 +43,61 @@ static inline ArrayHeader* get_array_header(void* array)
 
 void* mmarray_allocate(unsigned length, unsigned item_size)
 {
-    size_t memsize = calc_memsize(length, item_size);
+    return mmarray_allocate_with_flags(length, item_size, 0);
+}
 
-    ArrayHeader* a = mmap(NULL, memsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (a == MAP_FAILED) {
-        perror("mmap");
+void* mmarray_allocate_with_flags(unsigned length, unsigned item_size, unsigned page_flags)
+{
+    void* array = mmarray_try_allocate(length, item_size, page_flags);
+    if (!array) {
         abort();
     }
+    return array;
+}
+
+void* mmarray_try_allocate(unsigned length, unsigned item_size, unsigned page_flags)
+{
+    size_t memsize = calc_memsize(length, item_size, page_flags);
+
+    unsigned obtained_flags;
+    ArrayHeader* a = map_pages(memsize, page_flags, &obtained_flags);
+    if (!a) {
+        return nullptr;
+    }
     a->capacity = (memsize - sizeof(ArrayHeader)) / item_size;
     a->length = length;
     a->item_size = item_size;
+    a->page_flags = obtained_flags;
 
     // return pointer to the array data
     return a + 1;
 }
 
 void* mmarray_grow(void* array, unsigned increment)
+{
+    void* new_array = mmarray_try_grow(array, increment);
+    if (!new_array) {
+        perror("mremap");
+        abort();
+    }
+    return new_array;
+}
+
+void* mmarray_try_grow(void* array, unsigned increment)
 {
     ArrayHeader* a = get_array_header(array);
 
     if (a->length + increment > a->capacity) {
-        size_t old_memsize = calc_memsize(a->capacity, a->item_size);
-        size_t new_memsize = calc_memsize(a->length + increment, a->item_size);
+        size_t old_memsize = calc_memsize(a->capacity, a->item_size, a->page_flags);
+        size_t new_memsize = calc_memsize(a->length + increment, a->item_size, a->page_flags);
 
         ArrayHeader* new_array = mremap(a, old_memsize, new_memsize, MREMAP_MAYMOVE);
         if (new_array == MAP_FAILED) {
-            perror("mremap");
-            abort();
+            return nullptr;
+        }
+        if ((new_array->page_flags & (PAGES_POPULATE | PAGES_LOCK)) == PAGES_POPULATE) {
+            // locked mappings are populated by mremap
+            populate_pages(((uint8_t*) new_array) + old_memsize, new_memsize - old_memsize);
         }
         a = new_array;
         a->capacity = (new_memsize - sizeof(ArrayHeader)) / a->item_size;
@@ -80,10 +109,23 @@ void* mmarray_grow(void* array, unsigned increment)
 }
 
 void* mmarray_append_item(void* array, void* item)
+{
+    void* new_array = mmarray_try_append_item(array, item);
+    if (!new_array) {
+        perror("mremap");
+        abort();
+    }
+    return new_array;
+}
+
+void* mmarray_try_append_item(void* array, void* item)
 {
     unsigned index = mmarray_length(array);
 
-    array = mmarray_grow(array, 1);
+    array = mmarray_try_grow(array, 1);
+    if (!array) {
+        return nullptr;
+    }
     ArrayHeader* a = get_array_header(array);
 
     memcpy(((char*) array) + (index * a->item_size), item, a->item_size);
@@ -92,6 +134,12 @@ void* mmarray_append_item(void* array, void* item)
     return a + 1;
 }
 
+void mmarray_free(void* array)
+{
+    ArrayHeader* a = get_array_header(array);
+    unmap_pages(a, calc_memsize(a->capacity, a->item_size, a->page_flags));
+}
+
 unsigned mmarray_length(void* array)
 {
     return get_array_header(array)->length;
@@ -101,3 +149,8 @@ unsigned mmarray_capacity(void* array)
 {
     return get_array_header(array)->capacity;
 }
+
+unsigned mmarray_page_flags(void* array)
+{
+    return get_array_header(array)->page_flags;
+}
@@ -0,0 +1,298 @@
+#ifndef _GNU_SOURCE
+#   define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "allocator.h"
+#include "pages.h"
+
+#define DEFAULT_HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+
+static size_t huge_page_size = 0;
+
+size_t get_huge_page_size()
+{
+    if (huge_page_size == 0) {
+        // not using stdio here because this can be called from malloc replacement
+        size_t size = 0;
+        int fd = open("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", O_RDONLY);
+        if (fd != -1) {
+            char buf[32];
+            ssize_t n = read(fd, buf, sizeof(buf) - 1);
+            if (n > 0) {
+                buf[n] = 0;
+                size = strtoul(buf, nullptr, 10);
+            }
+            close(fd);
+        }
+        huge_page_size = size? size : DEFAULT_HUGE_PAGE_SIZE;
+    }
+    return huge_page_size;
+}
+
+/*
+ * Error messages are written without stdio because these functions
+ * are called from malloc replacement, where stdio may allocate again.
+ */
+
+static char* append_str(char* p, char* end, const char* str)
+{
+    while (*str && p < end) {
+        *p++ = *str++;
+    }
+    return p;
+}
+
+static char* append_num(char* p, char* end, size_t n, unsigned base)
+{
+    char digits[24];
+    unsigned i = 0;
+    do {
+        digits[i++] = "0123456789abcdef"[n % base];
+        n /= base;
+    } while (n);
+    if (base == 16) {
+        p = append_str(p, end, "0x");
+    }
+    while (i && p < end) {
+        *p++ = digits[--i];
+    }
+    return p;
+}
+
+static void print_error(const char* func_name, const char* call, void* addr, size_t size)
+/*
+ * Print "func_name call(addr, size): error description" for current errno.
+ * `addr` is omitted if nullptr.
+ */
+{
+    int error = errno;
+    char msg[256];
+    char* end = msg + sizeof(msg) - 1;
+    char* p = append_str(msg, end, func_name);
+    p = append_str(p, end, " ");
+    p = append_str(p, end, call);
+    p = append_str(p, end, "(");
+    if (addr) {
+        p = append_num(p, end, (uintptr_t) addr, 16);
+        p = append_str(p, end, ", ");
+    }
+    p = append_num(p, end, size, 10);
+    p = append_str(p, end, "): ");
+    const char* description = strerrordesc_np(error);
+    if (description) {
+        p = append_str(p, end, description);
+    } else {
+        p = append_str(p, end, "error ");
+        p = append_num(p, end, error, 10);
+    }
+    *p++ = '\n';
+    ssize_t unused = write(STDERR_FILENO, msg, p - msg);
+    (void) unused;
+}
+
+static inline size_t align_size(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+size_t align_to_pages(size_t size, unsigned flags)
+{
+    if (flags & PAGES_HUGETLB) {
+        return align_size(size, get_huge_page_size());
+    } else {
+        return align_size(size, sys_page_size);
+    }
+}
+
+static void* map_aligned(size_t size, int prot, int flags, size_t alignment)
+/*
+ * Map `size` bytes aligned at `alignment` boundary.
+ * Map a bigger range and trim excessive head and tail.
+ */
+{
+    size_t mem_size = size + alignment - sys_page_size;
+    uint8_t* mem = mmap(nullptr, mem_size, prot, flags, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+    uint8_t* result = align_pointer(mem, alignment);
+    size_t head = result - mem;
+    if (head) {
+        munmap(mem, head);
+    }
+    size_t tail = mem_size - head - size;
+    if (tail) {
+        munmap(result + size, tail);
+    }
+    return result;
+}
+
+static void* map_huge(size_t size, int prot, int flags, unsigned* obtained_flags)
+/*
+ * Map 2M-aligned range and advise transparent huge pages.
+ */
+{
+    void* result = map_aligned(size, prot, flags, get_huge_page_size());
+    if (result) {
+        if (madvise(result, size, MADV_HUGEPAGE) == 0) {
+            *obtained_flags |= PAGES_HUGE;
+        }
+    }
+    return result;
+}
+
+static unsigned apply_populate_lock(void* addr, size_t size, unsigned flags, bool populated)
+/*
+ * Apply PAGES_POPULATE and PAGES_LOCK options.
+ * Return options that were applied.
+ */
+{
+    unsigned obtained = 0;
+    if (flags & PAGES_LOCK) {
+        // mlock faults pages in as well
+        if (mlock(addr, size) == 0) {
+            return PAGES_LOCK | PAGES_POPULATE;
+        }
+        print_error(__func__, "mlock", addr, size);
+    }
+    if (flags & (PAGES_POPULATE | PAGES_LOCK)) {
+        if (populated || populate_pages(addr, size)) {
+            obtained |= PAGES_POPULATE;
+        }
+    }
+    return obtained;
+}
+
+void* map_pages(size_t size, unsigned flags, unsigned* obtained_flags)
+{
+    unsigned obtained = 0;
+    void* result = nullptr;
+    int prot = PROT_READ | PROT_WRITE;
+    int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    bool populated = false;
+
+    // MAP_POPULATE is not used for transparent huge pages
+    // because pages must be populated after madvise;
+    // locked pages are populated by mlock
+    int populate_flag = ((flags & PAGES_POPULATE) && !(flags & PAGES_LOCK))? MAP_POPULATE : 0;
+
+    if (size >= get_huge_page_size()) {
+        if (flags & PAGES_HUGETLB) {
+            result = mmap(nullptr, size, prot, map_flags | MAP_HUGETLB | populate_flag, -1, 0);
+            if (result == MAP_FAILED) {
+                result = nullptr;
+            } else {
+                obtained |= PAGES_HUGETLB;
+                populated = populate_flag;
+            }
+        }
+        if (!result && (flags & (PAGES_HUGE | PAGES_HUGETLB))) {
+            result = map_huge(size, prot, map_flags, &obtained);
+        }
+    }
+    if (!result) {
+        result = mmap(nullptr, size, prot, map_flags | populate_flag, -1, 0);
+        if (result == MAP_FAILED) {
+            print_error(__func__, "mmap", nullptr, size);
+            return nullptr;
+        }
+        populated = populate_flag;
+    }
+    obtained |= apply_populate_lock(result, size, flags, populated);
+    if (obtained_flags) {
+        *obtained_flags = obtained;
+    }
+    return result;
+}
+
+void* reserve_pages(size_t size, unsigned flags, unsigned* obtained_flags)
+{
+    unsigned obtained = 0;
+    void* result = nullptr;
+    int map_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+    if ((flags & (PAGES_HUGE | PAGES_HUGETLB)) && size >= get_huge_page_size()) {
+        result = map_huge(size, PROT_NONE, map_flags, &obtained);
+    }
+    if (!result) {
+        result = mmap(nullptr, size, PROT_NONE, map_flags, -1, 0);
+        if (result == MAP_FAILED) {
+            print_error(__func__, "mmap", nullptr, size);
+            return nullptr;
+        }
+    }
+    if (obtained_flags) {
+        *obtained_flags = obtained;
+    }
+    return result;
+}
+
+void* map_aligned_pages(size_t size, size_t alignment, unsigned flags, unsigned* obtained_flags)
+{
+    unsigned obtained = 0;
+    void* result = nullptr;
+    int prot = PROT_READ | PROT_WRITE;
+    int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if ((flags & (PAGES_HUGE | PAGES_HUGETLB)) && size >= get_huge_page_size() && alignment <= get_huge_page_size()) {
+        result = map_huge(size, prot, map_flags, &obtained);
+    }
+    if (!result) {
+        result = map_aligned(size, prot, map_flags, alignment);
+        if (!result) {
+            print_error(__func__, "mmap", nullptr, size);
+            return nullptr;
+        }
+    }
+    obtained |= apply_populate_lock(result, size, flags, false);
+    if (obtained_flags) {
+        *obtained_flags = obtained;
+    }
+    return result;
+}
+
+bool commit_pages(void* addr, size_t size, unsigned flags, unsigned* obtained_flags)
+{
+    if (mprotect(addr, size, PROT_READ | PROT_WRITE) == -1) {
+        print_error(__func__, "mprotect", addr, size);
+        return false;
+    }
+    unsigned obtained = apply_populate_lock(addr, size, flags, false);
+    if (obtained_flags) {
+        *obtained_flags &= obtained | ~(PAGES_POPULATE | PAGES_LOCK);
+    }
+    return true;
+}
+
+bool populate_pages(void* addr, size_t size)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(addr, size, MADV_POPULATE_WRITE) == 0) {
+        return true;
+    }
+    if (errno != EINVAL) {
+        // EINVAL means the kernel does not support MADV_POPULATE_WRITE
+        return false;
+    }
+#endif
+    volatile uint8_t* end = ((uint8_t*) addr) + size;
+    for (volatile uint8_t* p = addr; p < end; p += sys_page_size) {
+        *p = *p;
+    }
+    return true;
+}
+
+void unmap_pages(void* addr, size_t size)
+{
+    if (munmap(addr, size) == -1) {
+        print_error(__func__, "munmap", addr, size);
+    }
+}
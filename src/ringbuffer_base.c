@@ -3,6 +3,7 @@
 #endif
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,19 +11,40 @@
 #include <sys/mman.h>
 
 #include "allocator.h"
+#include "pages.h"
 #include "ringbuffer.h"
 
+static inline unsigned page_granularity(RingBuffer* ringbuf)
+/*
+ * Explicit huge pages can be remapped only in huge page steps.
+ */
+{
+    if (ringbuf->page_flags & PAGES_HUGETLB) {
+        return get_huge_page_size();
+    } else {
+        return sys_page_size;
+    }
+}
+
 bool init_ringbuffer(RingBuffer* ringbuf, unsigned size)
 {
-    ringbuf->size = align_unsigned(size, sys_page_size);
-    if (ringbuf->size == 0) {
-        ringbuf->size = sys_page_size;
+    return init_ringbuffer_with_flags(ringbuf, size, 0);
+}
+
+bool init_ringbuffer_with_flags(RingBuffer* ringbuf, unsigned size, unsigned page_flags)
+{
+    if (size == 0) {
+        size = 1;
     }
-    ringbuf->data = mmap(nullptr, ringbuf->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (ringbuf->data == MAP_FAILED) {
-        fprintf(stderr, "%s mmap: %s\n", __func__, strerror(errno));
+    size_t mem_size = align_to_pages(size, page_flags);
+    if (mem_size > UINT_MAX) {
         return false;
     }
+    ringbuf->data = map_pages(mem_size, page_flags, &ringbuf->page_flags);
+    if (!ringbuf->data) {
+        return false;
+    }
+    ringbuf->size = mem_size;
     ringbuf->head = 0;
     ringbuf->tail = 0;
     return true;
@@ -31,7 +53,7 @@ bool init_ringbuffer(RingBuffer* ringbuf, unsigned size)
 void fini_ringbuffer(RingBuffer* ringbuf)
 {
     if (ringbuf->data) {
-        munmap(ringbuf->data, ringbuf->size);
+        unmap_pages(ringbuf->data, ringbuf->size);
         ringbuf->data = nullptr;
     }
 }
@@ -64,9 +86,10 @@ void delete_ringbuffer(RingBuffer** ringbuf_ptr)
 
 bool grow_ringbuffer(RingBuffer* ringbuf, unsigned new_size)
 {
-    new_size = align_unsigned(new_size, sys_page_size);
+    unsigned granularity = page_granularity(ringbuf);
+    new_size = align_unsigned(new_size, granularity);
     if (new_size == 0) {
-        new_size = sys_page_size;
+        new_size = granularity;
     }
     if (new_size <= ringbuf->size) {
         return true;
@@ -76,6 +99,10 @@ bool grow_ringbuffer(RingBuffer* ringbuf, unsigned new_size)
         return false;
     }
     ringbuf->data = new_addr;
+    if ((ringbuf->page_flags & (PAGES_POPULATE | PAGES_LOCK)) == PAGES_POPULATE) {
+        // locked mappings are populated by mremap
+        populate_pages(new_addr + ringbuf->size, new_size - ringbuf->size);
+    }
 
     if (ringbuf->head > ringbuf->tail) {
         // shift upper data up to the end of buffer
@@ -91,9 +118,10 @@ bool grow_ringbuffer(RingBuffer* ringbuf, unsigned new_size)
 
 void shrink_ringbuffer(RingBuffer* ringbuf, unsigned new_size)
 {
-    new_size = align_unsigned(new_size, sys_page_size);
+    unsigned granularity = page_granularity(ringbuf);
+    new_size = align_unsigned(new_size, granularity);
     if (new_size == 0) {
-        new_size = sys_page_size;
+        new_size = granularity;
     }
     if (new_size >= ringbuf->size) {
         return;
@@ -102,14 +130,14 @@ void shrink_ringbuffer(RingBuffer* ringbuf, unsigned new_size)
     if (ringbuf->head == ringbuf->tail) {
         // buffer is empty
         ringbuf->head = ringbuf->tail = 0;
-        shrinkable_bytes = ringbuf->size - sys_page_size;
+        shrinkable_bytes = ringbuf->size - granularity;
         if (shrinkable_bytes == 0) {
             return;
         }
     } else {
         // buffer is not empty, check if we can shrink
         if (ringbuf->head > ringbuf->tail) {
-            shrinkable_bytes = (ringbuf->head - ringbuf->tail - 1) & ~(sys_page_size - 1);
+            shrinkable_bytes = (ringbuf->head - ringbuf->tail - 1) & ~(granularity - 1);
             if (shrinkable_bytes == 0) {
                 return;
             }
@@ -119,7 +147,7 @@ void shrink_ringbuffer(RingBuffer* ringbuf, unsigned new_size)
             memmove(upper_data - shrinkable_bytes, upper_data, upper_data_size);
             ringbuf->head -= shrinkable_bytes;
         } else {
-            shrinkable_bytes = (ringbuf->head + ringbuf->size - ringbuf->tail - 1) & ~(sys_page_size - 1);
+            shrinkable_bytes = (ringbuf->head + ringbuf->size - ringbuf->tail - 1) & ~(granularity - 1);
             if (shrinkable_bytes == 0) {
                 return;
             }
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "test.h"
+
+/*
+ * Usage: test_pussy [name...]
+ *
+ * Run all tests or only those given on command line.
+ */
+
+typedef struct {
+    const char* name;
+    void (*run)();
+} Test;
+
+static Test tests[] = {
+    { "arena",     test_arena },
+    { "fsb_arena", test_fsb_arena },
+};
+
+#define NUM_TESTS  (sizeof(tests) / sizeof(tests[0]))
+
+unsigned test_failures = 0;
+
+static void run(Test* test)
+{
+    printf("%s\n", test->name);
+    test->run();
+}
+
+int main(int argc, char* argv[])
+{
+    init_allocator(&pet_allocator);
+
+    if (argc < 2) {
+        for (unsigned i = 0; i < NUM_TESTS; i++) {
+            run(&tests[i]);
+        }
+    }
+    for (int a = 1; a < argc; a++) {
+        unsigned i = 0;
+        while (i < NUM_TESTS && strcmp(tests[i].name, argv[a]) != 0) {
+            i++;
+        }
+        if (i == NUM_TESTS) {
+            fprintf(stderr, "Unknown test %s\n", argv[a]);
+            return 1;
+        }
+        run(&tests[i]);
+    }
+    if (test_failures) {
+        fprintf(stderr, "%u checks failed\n", test_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * Test helpers.
+ *
+ * Failed checks are reported and counted, tests keep running.
+ */
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern unsigned test_failures;
+
+#define CHECK(condition)  \
+    do {  \
+        if (!(condition)) {  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);  \
+            test_failures++;  \
+        }  \
+    } while (0)
+
+/*
+ * Tests, see main.c
+ */
+
+void test_arena();
+void test_fsb_arena();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "test.h"
+
+static bool all_bytes(uint8_t* block, unsigned size, uint8_t value)
+{
+    for (unsigned i = 0; i < size; i++) {
+        if (block[i] != value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void fill_first_region(Arena* arena)
+/*
+ * Allocate until the first region has no space left,
+ * leaving the next region retained and empty.
+ */
+{
+    ArenaMark start = arena_mark(arena);
+    for (;;) {
+        ArenaMark mark = arena_mark(arena);
+        _arena_alloc(arena, 16, 1);
+        if (arena_mark(arena).region != start.region) {
+            arena_rewind(arena, mark, ARENA_KEEP_REGIONS);
+            return;
+        }
+    }
+}
+
+static void test_rewind_keeps_fit_blocks()
+/*
+ * Blocks placed by `_arena_fit` before the mark must survive the rewind.
+ */
+{
+    Arena* arena = create_arena(4096);
+    fill_first_region(arena);
+
+    uint8_t* fitted = _arena_fit(arena, 100, 1);
+    CHECK(fitted != nullptr);
+    memset(fitted, 0x5a, 100);
+
+    ArenaMark mark = arena_mark(arena);
+    uint8_t* block = _arena_alloc(arena, 100, 1);
+    memset(block, 0xa5, 100);
+    arena_rewind(arena, mark, ARENA_KEEP_REGIONS);
+
+    block = _arena_alloc(arena, 1000, 1);
+    memset(block, 0xa5, 1000);
+    CHECK(all_bytes(fitted, 100, 0x5a));
+
+    delete_arena(arena);
+}
+
+static void test_reset_reuses_regions()
+{
+    Arena* arena = create_arena(4096);
+    fill_first_region(arena);
+    arena_reset(arena, 0);
+
+    // first region is available again, retained one is reused after it
+    fill_first_region(arena);
+    uint8_t* fitted = _arena_fit(arena, 100, 1);
+    CHECK(fitted != nullptr);
+    memset(fitted, 0x5a, 100);
+    CHECK(all_bytes(fitted, 100, 0x5a));
+    CHECK(arena_stats(arena).mmap_calls == 2);
+
+    delete_arena(arena);
+}
+
+static void test_high_water_mark()
+{
+    Arena* arena = create_arena(4096);
+    ArenaMark mark = arena_mark(arena);
+    for (unsigned i = 0; i < 10; i++) {
+        _arena_alloc(arena, 1000, 1);
+    }
+    void* block = _arena_alloc(arena, 1000, 1);
+    CHECK(arena_extend(arena, block, 1000, 500));
+    arena_rewind(arena, mark, ARENA_KEEP_REGIONS);
+    CHECK(arena_stats(arena).high_water_mark == 11000);
+    CHECK(arena_stats(arena).bytes_used == 0);
+
+    _arena_alloc(arena, 2000, 1);
+    arena_reset(arena, 0);
+    _arena_alloc(arena, 100, 1);
+    ArenaStats stats = arena_stats(arena);
+    CHECK(stats.high_water_mark == 11000);
+    CHECK(stats.bytes_used == 100);
+
+    delete_arena(arena);
+}
+
+static void test_save_to_opened_file()
+/*
+ * Writable snapshot is saved back to the file it is mapped from.
+ */
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_pussy_arena.%d", getpid());
+
+    Arena* arena = create_contiguous_arena(1 << 24, 0);
+    unsigned* first = arena_alloc(arena, 1, unsigned);
+    *first = 1;
+    ArenaOffset offset = arena_offset(arena, first);
+    CHECK(arena_save(arena, path));
+    delete_arena(arena);
+
+    for (unsigned i = 2; i <= 3; i++) {
+        arena = arena_open(path, true);
+        CHECK(arena != nullptr);
+        if (!arena) {
+            break;
+        }
+        first = arena_pointer(arena, offset);
+        CHECK(*first == i - 1);
+        *first = i;
+        arena_alloc(arena, 100000, unsigned);
+        CHECK(arena_save(arena, path));
+        CHECK(arena_stats(arena).bytes_used == sizeof(unsigned) + (i - 1) * 100000 * sizeof(unsigned));
+        delete_arena(arena);
+    }
+    unlink(path);
+}
+
+void test_arena()
+{
+    test_rewind_keeps_fit_blocks();
+    test_reset_reuses_regions();
+    test_high_water_mark();
+    test_save_to_opened_file();
+}
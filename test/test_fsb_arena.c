@@ -0,0 +1,147 @@
+#include <stdint.h>
+
+#include "fsb_arena.h"
+#include "test.h"
+
+#define NUM_BLOCKS  100
+
+static void count_block(FsbArena* arena, void* cb_data, void* block_ptr)
+{
+    (*(unsigned*) cb_data)++;
+}
+
+static unsigned count_blocks(FsbArena* arena)
+{
+    unsigned n = 0;
+    fsb_arena_walk(arena, count_block, &n);
+    return n;
+}
+
+static void test_single_page_slabs()
+/*
+ * Blocks that fit in a page get single-page slabs
+ * and can be released without knowing the arena.
+ */
+{
+    static const unsigned block_sizes[] = { 16, 700, 1500 };
+
+    for (unsigned i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+        FsbArena arena;
+        CHECK(_init_fsb_arena(&arena, block_sizes[i], 8));
+        CHECK(arena.slab_size == sys_page_size);
+
+        void* blocks[NUM_BLOCKS];
+        for (unsigned j = 0; j < NUM_BLOCKS; j++) {
+            blocks[j] = fsb_arena_allocate(&arena);
+            CHECK(fsb_arena_of(blocks[j]) == &arena);
+        }
+        for (unsigned j = 0; j < NUM_BLOCKS; j++) {
+            fsb_arena_release(&blocks[j]);
+            CHECK(blocks[j] == nullptr);
+        }
+        CHECK(count_blocks(&arena) == 0);
+        destroy_fsb_arena(&arena);
+    }
+}
+
+static void test_multi_page_slabs()
+/*
+ * Blocks in all pages of multi-page slab are released with the arena.
+ */
+{
+    FsbArena arena;
+    CHECK(_init_fsb_arena_with_slab_size(&arena, 700, 8, 4 * sys_page_size));
+    CHECK(arena.slab_size == 4 * sys_page_size);
+    CHECK(!_init_fsb_arena_with_slab_size(&arena, 700, 8, 3 * sys_page_size));
+
+    void* blocks[NUM_BLOCKS];
+    unsigned beyond_first_page = 0;
+    for (unsigned i = 0; i < NUM_BLOCKS; i++) {
+        blocks[i] = fsb_arena_allocate(&arena);
+        uintptr_t offset = ((uintptr_t) blocks[i]) & (arena.slab_size - 1);
+        if (offset >= sys_page_size) {
+            beyond_first_page++;
+        }
+    }
+    CHECK(beyond_first_page > 0);
+    CHECK(count_blocks(&arena) == NUM_BLOCKS);
+
+    for (unsigned i = 0; i < NUM_BLOCKS; i++) {
+        fsb_arena_free(&arena, &blocks[i]);
+    }
+    CHECK(count_blocks(&arena) == 0);
+    destroy_fsb_arena(&arena);
+
+    // blocks that don't fit in a page get multi-page slabs by default
+    CHECK(_init_fsb_arena(&arena, sys_page_size, 8));
+    CHECK(arena.slab_size > sys_page_size);
+    destroy_fsb_arena(&arena);
+}
+
+static void test_pages_reused()
+/*
+ * Only retained empty pages are counted as reused, not the last page
+ * which is always kept.
+ */
+{
+    FsbArena arena;
+    CHECK(_init_fsb_arena(&arena, 1024, 8));
+    void* block = fsb_arena_allocate(&arena);
+    fsb_arena_free(&arena, &block);
+    block = fsb_arena_allocate(&arena);
+    CHECK(arena.mmap_calls == 1);
+    CHECK(arena.pages_reused == 0);
+    CHECK(arena.num_empty_pages == 0);
+    fsb_arena_free(&arena, &block);
+
+    // fill two pages, release all blocks and allocate them again
+    arena.max_empty_pages = 1;
+    unsigned n = 2 * arena.blocks_per_page;
+    void* blocks[n];
+    for (unsigned round = 0; round < 2; round++) {
+        CHECK(fsb_arena_allocate_n(&arena, n, blocks) == n);
+        fsb_arena_release_n(&arena, n, blocks);
+        CHECK(arena.num_empty_pages == 1);
+    }
+    CHECK(arena.mmap_calls == 2);
+    CHECK(arena.munmap_calls == 0);
+    CHECK(arena.pages_reused == 1);
+    destroy_fsb_arena(&arena);
+}
+
+static void test_handles_of_free_slots()
+/*
+ * Handles of free slots neither resolve nor release.
+ */
+{
+    FsbArena arena;
+    CHECK(_init_fsb_arena_with_handles(&arena, 64, 8));
+
+    FsbHandle handle = fsb_arena_allocate_handle(&arena);
+    void* block = fsb_arena_handle_to_ptr(&arena, handle);
+    CHECK(block != nullptr);
+    CHECK(fsb_arena_release_handle(&arena, handle));
+    CHECK(!fsb_arena_release_handle(&arena, handle));
+    CHECK(fsb_arena_handle_to_ptr(&arena, handle) == nullptr);
+
+    // handle with current generation of the free slot
+    FsbHandle free_slot = fsb_arena_ptr_to_handle(&arena, block);
+    CHECK(fsb_arena_handle_to_ptr(&arena, free_slot) == nullptr);
+    CHECK(!fsb_arena_release_handle(&arena, free_slot));
+
+    // free blocks count is intact: the page is full after blocks_per_page allocations
+    for (unsigned i = 0; i < arena.blocks_per_page; i++) {
+        CHECK(fsb_arena_allocate_handle(&arena) != 0);
+    }
+    CHECK(arena.mmap_calls == 1);
+    CHECK(arena.avail_pages == nullptr);
+    destroy_fsb_arena(&arena);
+}
+
+void test_fsb_arena()
+{
+    test_single_page_slabs();
+    test_multi_page_slabs();
+    test_pages_reused();
+    test_handles_of_free_slots();
+}